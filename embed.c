@@ -0,0 +1,66 @@
+#include "raylib/include/raylib.h"
+
+#include <stdio.h>
+
+#define EMBED_ASSETS_MAX 64
+
+// decodes the sprites at build time and writes them out as a header of raw RGBA pixels,
+// main.c includes it when built with EMBEDDED_ASSETS so the game never touches the png files
+//
+// usage: embed <output.h> <image.png>...
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("usage: %s <output.h> <image.png>...\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "w");
+    if (file == NULL) {
+        printf("failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    if (argc - 2 > EMBED_ASSETS_MAX) {
+        printf("at most %i images can be embedded\n", EMBED_ASSETS_MAX);
+        fclose(file);
+        return 1;
+    }
+
+    int widths[EMBED_ASSETS_MAX];
+    int heights[EMBED_ASSETS_MAX];
+
+    fprintf(file, "// generated by embed.c, do not edit\n\n");
+
+    for (int i = 2; i < argc; i++) {
+        Image image = LoadImage(argv[i]);
+        if (image.data == NULL) {
+            printf("failed to load %s\n", argv[i]);
+            fclose(file);
+            return 1;
+        }
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+        int size = image.width * image.height * 4;
+        unsigned char *data = image.data;
+
+        fprintf(file, "static unsigned char embedded_asset_%i[%i] = {", i - 2, size);
+        for (int j = 0; j < size; j++) {
+            fprintf(file, "%s0x%02x,", (j % 32) ? "" : "\n    ", data[j]);
+        }
+        fprintf(file, "\n};\n\n");
+
+        widths[i - 2] = image.width;
+        heights[i - 2] = image.height;
+        UnloadImage(image);
+    }
+
+    fprintf(file, "static const EmbeddedAsset embedded_assets[] = {\n");
+    for (int i = 2; i < argc; i++) {
+        fprintf(file, "    { \"%s\", %i, %i, embedded_asset_%i },\n", GetFileName(argv[i]), widths[i - 2], heights[i - 2], i - 2);
+    }
+    fprintf(file, "};\n");
+
+    fclose(file);
+    return 0;
+}
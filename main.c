@@ -1,24 +1,62 @@
+#if !defined(_WIN32)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "raylib/include/raylib.h"
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 #include <math.h>
 
+#include <pthread.h>
+
+#if !defined(_WIN32)
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 #define LEVEL_MAX_CHANGE 10
 
 #define PNG_DIMENSIONS 192
-#define GRID_WIDTH 19
-#define GRID_HEIGHT 22
+#define BUILTIN_MAZE_WIDTH 19
+#define BUILTIN_MAZE_HEIGHT 22
+
+#define GRID_WIDTH (state->grid_width)
+#define GRID_HEIGHT (state->grid_height)
+#define GRID_SIZE_MAX 1024
+
+// the grid is stored in square tiles of 8x8 cells, 64 bytes, so neighbors are nearly always on the same cache line
+#define GRID_TILE_SHIFT 3
+#define GRID_TILE_SIZE (1 << GRID_TILE_SHIFT)
+#define GRID_TILE_MASK (GRID_TILE_SIZE - 1)
+#define GRID_TILE_CELLS (GRID_TILE_SIZE * GRID_TILE_SIZE)
 
 typedef struct GridPosition {
     int x; int y;
 } GridPosition;
 
+// offset in subcells from a cell, or from the grid origin, see SUBCELL_COUNT
+typedef struct SubcellOffset {
+    int x; int y;
+} SubcellOffset;
+
 #define GRID_TOP_RIGHT ((GridPosition){GRID_WIDTH-1,0})
 #define GRID_TOP_LEFT ((GridPosition){0,0})
 #define GRID_BOTTOM_LEFT ((GridPosition){0,GRID_HEIGHT-1})
 #define GRID_BOTTOM_RIGHT ((GridPosition){GRID_WIDTH-1,GRID_HEIGHT-1})
-#define GRID_WIDTH 19
-#define GRID_HEIGHT 22
 
 #define FLAG_NONE 0
 #define FLAG_WALL (1 << 0)
@@ -30,21 +68,71 @@ typedef struct GridPosition {
 #define FLAG_WALL_TO_LEFT (1 << 6)
 #define FLAG_WALL_BELOW (1 << 7)
 
-#define SPEED_MULTIPLIER 6.0f
-#define SPEED_PLAYER (1.0f * SPEED_MULTIPLIER)
-#define SPEED_GHOST_INSIDE (0.5f * SPEED_MULTIPLIER)
-#define SPEED_GHOST_LEAVING (0.5f * SPEED_MULTIPLIER)
-#define SPEED_GHOST_OUTSIDE (1.0f * SPEED_MULTIPLIER)
-#define SPEED_GHOST_FRIGHTENED (0.5f * SPEED_MULTIPLIER)
-#define SPEED_GHOST_RETURNING (1.0f * SPEED_MULTIPLIER)
-
-#define CELL_PLAYER_START ((GridPosition){9,16})
-#define CELL_OUTSIDE_GHOST_HOUSE_DOOR ((GridPosition){9,8})
-#define CELL_GHOST_HOUSE_DOOR ((GridPosition){9,8})
-#define CELL_GHOST_HOUSE_CENTER ((GridPosition){9,10})
-#define CELL_GHOST_HOUSE_CENTER ((GridPosition){9,10})
-#define CELL_GHOST_HOUSE_RIGHT_SIDE ((GridPosition){10,10})
-#define CELL_GHOST_HOUSE_LEFT_SIDE ((GridPosition){8,10})
+// the simulation is integer only so a game plays out bit-identically on every compiler and optimization level:
+// positions between cells count in subcells, speeds in subcells per tick and timers in ticks
+#define SUBCELL_COUNT (SIMULATION_RATE * 20) // keeps every speed below a whole number
+#define SUBCELLS_TO_CELLS(subcells) ((float)(subcells) / SUBCELL_COUNT)
+#define SECONDS_TO_TICKS(seconds) ((int)((seconds) * SIMULATION_RATE))
+#define TICKS_TO_SECONDS(ticks) ((float)(ticks) / SIMULATION_RATE)
+
+#define COLLISION_DISTANCE (SUBCELL_COUNT / 2)
+
+#define SPEED_MULTIPLIER 6
+#define SPEED_FULL (SPEED_MULTIPLIER * SUBCELL_COUNT / SIMULATION_RATE)
+#define SPEED_HALF (SPEED_FULL / 2)
+#define SPEED_PLAYER SPEED_FULL
+#define SPEED_GHOST_INSIDE SPEED_HALF
+#define SPEED_GHOST_LEAVING SPEED_HALF
+#define SPEED_GHOST_OUTSIDE SPEED_FULL
+#define SPEED_GHOST_FRIGHTENED SPEED_HALF
+#define SPEED_GHOST_RETURNING SPEED_FULL
+
+#define CELL_PLAYER_START (state->level->player_start)
+#define CELL_OUTSIDE_GHOST_HOUSE_DOOR (state->level->outside_ghost_house_door)
+#define CELL_GHOST_HOUSE_DOOR (state->level->ghost_house_door)
+#define CELL_GHOST_HOUSE_CENTER (state->level->ghost_house_center)
+#define CELL_GHOST_HOUSE_RIGHT_SIDE (state->level->ghost_house_right_side)
+#define CELL_GHOST_HOUSE_LEFT_SIDE (state->level->ghost_house_left_side)
+
+#define LEVEL_FILE_MAGIC 0x4c564c50 // "PLVL" when read as little endian bytes
+#define LEVEL_FILE_VERSION 2
+#define LEVEL_FILE_EXTENSION ".lvl"
+#define LEVEL_TUNNELS_MAX 16
+
+#define HEATMAP_FILE_MAGIC 0x54414548 // "HEAT"
+#define HEATMAP_FILE_VERSION 1
+
+#define GENERATOR_ATTEMPTS_MAX 64
+#define GENERATOR_EXTRA_EDGE_PERCENT 15
+#define GENERATOR_THREADS_MAX 64
+
+#define JOB_THREADS_MAX 8
+#define PERF_THREADS_MAX (JOB_THREADS_MAX + 4) // job workers, render, simulation and the asset loader
+#define RENDER_COMMANDS_PER_CELL 4 // a wall cell emits up to four rectangles, a floor cell at most one dot
+#define NOISE_AMOUNT 100
+
+#define EVENT_LOG_MAGIC 0x4c545645 // "EVTL"
+#define EVENT_LOG_VERSION 1
+#define EVENT_LOG_SIZE 4096 // power of two
+#define EVENT_LOG_FLUSH_INTERVAL 0.01
+
+#define METRICS_SHM_NAME "/pac-drug-metrics"
+#define METRICS_MAGIC 0x5254454d // "METR"
+#define METRICS_VERSION 1
+#define METRICS_DROPPED_FRAME_TIME (1.5f / 60.0f) // half a frame late at the target 60 fps
+
+#define PATH_CLUSTER_SIZE 16
+#define PATH_CLUSTER_CELLS (PATH_CLUSTER_SIZE * PATH_CLUSTER_SIZE)
+#define PATH_SIDE_ENTRANCES (PATH_CLUSTER_SIZE / 2) // open runs along one side are at least one wall apart
+#define PATH_CLUSTER_ENTRANCES (PATH_SIDE_ENTRANCES * 4)
+#define PATH_UNREACHABLE 0xffff
+#define PATH_DISTANCE_MAX 0x7fffffff
+#define PATH_FIELDS_MAX 8
+#define PATH_HIERARCHY_MIN_CELLS (64 * 64) // smaller mazes keep the classic straight line ghost targeting
+
+#define FARM_WORKERS_MAX 64
+#define FARM_QUEUE_SIZE 256 // power of two
+#define FARM_TICKS_MAX (SIMULATION_RATE * 60 * 10)
 
 #define COLOR_PLAYER ((Color){0xff,0xff,0x00,0xff})
 #define COLOR_BLINKY ((Color){0xff,0x00,0x00,0xff})
@@ -61,7 +149,23 @@ typedef struct GridPosition {
 #define GAP_SIZE_MULTIPLIER 75
 #define HALF_GAP_SIZE_MULTIPLIER (GAP_SIZE_MULTIPLIER / 2)
 
-#define LEVEL_INTRO_LENGTH 1.0f
+#define LEVEL_INTRO_LENGTH SECONDS_TO_TICKS(1)
+
+#define STARTUP_PHASES_MAX 32
+
+#define TRACE_EVENTS_MAX (1 << 16) // per thread
+#define TRACE_THREADS_MAX 32
+#define TRACE_DEFAULT_FILE "trace.json"
+
+#define SIMULATION_RATE 120
+#define SIMULATION_DELTA_TIME (1.0f / SIMULATION_RATE)
+#define SIMULATION_CATCH_UP_MAX 0.25
+#define SNAPSHOT_COUNT 3
+#define SNAPSHOT_FRESH 4
+#define GRID_CHANGES_MAX 64 // power of two, a snapshot further behind than this copies the whole grid
+#define INPUT_QUEUE_SIZE 64 // power of two
+
+#define CELL_SIZE_MIN 20.0f
 
 enum {
     DIRECTION_NONE,
@@ -109,34 +213,206 @@ typedef struct {
     GridPosition position;
     int direction;
     int requested_direction;
-    Vector2 fraction_position;
+    SubcellOffset fraction_position;
 } Player;
 
+// on-disk level layout, the file is used directly from memory so this must not contain pointers
+// the header is followed by the cell bytes in the same tiled layout as State.grid
+// the cells already contain the FLAG_WALL_* neighbor flags so loading does no work besides the checksum
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int checksum; // CRC32 of everything from "width" to the end of the file
+    int width;
+    int height;
+    int dot_count;
+    GridPosition player_start;
+    GridPosition outside_ghost_house_door;
+    GridPosition ghost_house_door;
+    GridPosition ghost_house_center;
+    GridPosition ghost_house_left_side;
+    GridPosition ghost_house_right_side;
+    int tunnel_count;
+    GridPosition tunnels[LEVEL_TUNNELS_MAX];
+} LevelHeader;
+
+// the maze with every corridor collapsed into one edge between two junctions
+// a junction is a cell with other than two ways out, a loop without any gets one of its cells as a junction
+typedef struct {
+    GridPosition position;
+    int edges[4]; // per direction from DIRECTION_RIGHT, -1 where there is no way out
+} GraphNode;
+
+typedef struct {
+    int from; // node
+    int to;
+    int from_direction; // leaving "from" into the edge
+    int to_direction; // leaving "to" into the edge
+    int length; // steps between the nodes, going through a tunnel takes two
+    int first_cell; // into MazeGraph.edge_cells, the cells between the nodes in order from "from"
+    int cell_count;
+} GraphEdge;
+
+// indexed like the grid so any cell is one lookup away from its place in the graph
+typedef struct {
+    int node; // -1 unless a junction
+    int edge; // -1 unless a corridor cell
+    int offset; // steps from the "from" node of the edge
+} GraphCell;
+
+typedef struct {
+    bool built;
+    GraphNode *nodes;
+    int node_count;
+    GraphEdge *edges;
+    int edge_count;
+    int *edge_cells; // grid indices
+    int edge_cell_count;
+    GraphCell *cells;
+} MazeGraph;
+
+// everything about a maze that never changes during play, built the first time the maze is played
+// restarting a level is then a copy of the pristine cells plus resetting the actors
+typedef struct {
+    bool built;
+    int tiles_x;
+    size_t grid_size;
+    int dot_count; // counted from the cells, restarting a level copies them so no dot list is needed
+} LevelTemplate;
+
+enum {
+    HEATMAP_PLAYER,
+    HEATMAP_GHOSTS, // one layer per ghost from here
+    HEATMAP_ACTOR_COUNT = HEATMAP_GHOSTS + GHOST_COUNT,
+};
+
+typedef struct {
+    int width;
+    int height;
+    unsigned int *visits; // HEATMAP_ACTOR_COUNT layers
+    unsigned int max[HEATMAP_ACTOR_COUNT];
+} Heatmap;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    int maze_count;
+} HeatmapFileHeader;
+
+// followed by HEATMAP_ACTOR_COUNT layers of width * height counts
+typedef struct {
+    unsigned int checksum;
+    int width;
+    int height;
+} HeatmapFileMaze;
+
+// hierarchical pathfinding for mazes too big for a distance table: the maze is cut into clusters,
+// every run of open cells along a cluster border gets one entrance on each side,
+// and each cluster caches the distance from each of its entrances to each of its cells
+typedef struct {
+    int x; int y; // first cell
+    int width; int height;
+    int entrance_count;
+    signed char columns[PATH_CLUSTER_ENTRANCES]; // per entrance slot, -1 if unused
+    unsigned char slots[PATH_CLUSTER_ENTRANCES]; // per column
+    unsigned char entrance_cells[PATH_CLUSTER_ENTRANCES]; // per entrance slot, local cell index
+    unsigned short *distances; // local cell * entrance_count + column, PATH_UNREACHABLE if there is no way inside the cluster
+} PathCluster;
+
+typedef struct {
+    int distance;
+    int node;
+} PathHeapEntry;
+
+// distances from every entrance to one target, the search runs only as far as the questions asked so far need
+// entrance nodes are cluster * PATH_CLUSTER_ENTRANCES + slot
+typedef struct {
+    GridPosition target;
+    bool valid;
+    unsigned int used; // the least recently used field is replaced
+    unsigned int stamp; // distances of nodes not seen with this stamp are left over from an older target
+    int cluster;
+    unsigned short local[PATH_CLUSTER_CELLS]; // inside the cluster of the target
+    int *distances;
+    unsigned int *seen;
+    unsigned int *settled;
+    PathHeapEntry *heap;
+    int heap_count;
+    int heap_capacity;
+} PathField;
+
+// one breadth first search over the maze for the target every chasing ghost shares: the player
+// it only runs as far out as the ghosts asked so far, so the cost follows how far they are, not the maze size
+// the tunnel cells just outside the maze are nodes too since going through a tunnel takes a step there,
+// one per row for the left and right side and one per column for the top and bottom
+typedef struct {
+    GridPosition target;
+    bool valid;
+    unsigned int stamp; // distances of nodes not seen with this stamp are left over from an older target
+    int *distances; // cells by y * width + x, then the row tunnels, then the column tunnels
+    unsigned int *seen;
+    int *queue;
+    int head;
+    int tail;
+} PathFlow;
+
+// walls never change during play, so it is built once per maze and kept for every level on it
+typedef struct {
+    bool built;
+    int width;
+    int height;
+    int tiles_x;
+    int clusters_x;
+    int clusters_y;
+    PathCluster *clusters;
+    PathField fields[PATH_FIELDS_MAX];
+    PathFlow flow;
+    unsigned int stamp;
+    unsigned int clock;
+} PathHierarchy;
+
+typedef struct {
+    const LevelHeader *header;
+    const unsigned char *cells;
+    void *memory;
+    size_t size;
+    bool mapped;
+    LevelTemplate template;
+    MazeGraph graph; // only once something asked for it, it takes more memory than the grid
+    Heatmap heatmap;
+    PathHierarchy paths; // only for mazes of at least PATH_HIERARCHY_MIN_CELLS
+} Maze;
+
 typedef struct {
     int state;
     int shape;
     GridPosition (*get_target)(void);
     GridPosition target;
     GridPosition position;
-    float fraction_position;
+    int fraction_position; // subcells travelled towards the next cell
     int direction;
     Color color;
-    Texture texture;
     int wait_amount;
 } Ghost;
 
+typedef struct {
+    unsigned long long state;
+} Rng;
+
 typedef struct {
     float global_sine;
-    float global_sine_timer;
+    int global_sine_timer;
     float global_cosine;
 
     int level_idx;
+    int maze_offset; // maze of the first level, farm games start on the maze of their job
 
-    float level_scatter_min;
-    float level_scatter_max;
+    // seconds
+    int level_scatter_min;
+    int level_scatter_max;
 
-    float level_chase_min;
-    float level_chase_max;
+    int level_chase_min;
+    int level_chase_max;
 
     Player player;
 
@@ -144,40 +420,80 @@ typedef struct {
     Ghost *death_by_ghost;
     int ghost_phase;
 
-    float red_ghost_speed_multiplier;
+    int red_ghost_speed;
 
-    float ghost_scatter_timer;
-    float ghost_scatter_target_time;
+    // ticks
+    int ghost_scatter_timer;
+    int ghost_scatter_target_time;
 
-    float ghost_chase_timer;
-    float ghost_chase_target_time;
+    int ghost_chase_timer;
+    int ghost_chase_target_time;
 
-    float ghost_frightened_timer;
-    float ghost_frightened_target_time;
+    int ghost_frightened_timer;
+    int ghost_frightened_target_time;
 
-    Texture ghost_frightened_texture;
-    Texture ghost_returning_texture;
-
-    int grid[GRID_WIDTH][GRID_HEIGHT];
+    int grid_width;
+    int grid_height;
+    int grid_tiles_x;
+    size_t grid_size;
+    unsigned char *grid;
 
     int dot_count;
 
+    Maze *mazes;
+    int maze_count;
+    const LevelHeader *level;
+    PathHierarchy *paths; // of the current maze, NULL for small mazes
+    Heatmap *heatmap; // of the current maze, NULL unless heatmaps are recorded
+
     Texture texture;
 
-    float render_x_offset;
+    Vector2 render_offset;
+
+    // ticks
+    int level_intro;
+    int death_timer;
+
+    bool assets_ready;
+
+    // bumped on every grid write so snapshots only update the grid when it changed
+    unsigned long long grid_version;
+    unsigned long long grid_reset_version; // the whole grid was replaced, snapshots from before copy all of it
+    int grid_changes[GRID_CHANGES_MAX]; // grid index written by each of the latest versions
+
+    // wall time of the newest input event applied, travels with the snapshot so presenting it can be timed
+    double input_time;
 
-    float level_intro;
+    Rng rng;
+
+    unsigned int tick;
 } State;
 
-State *state;
+// the simulation thread points this at the live state, the render thread at the newest snapshot
+__thread State *state;
+
+typedef struct {
+    const char *file_name;
+    int width;
+    int height;
+    unsigned char *data; // R8G8B8A8
+} EmbeddedAsset;
+
+#if EMBEDDED_ASSETS
+#include "assets.h"
+#endif
 
 static inline float get_cell_size() {
     float w = GetScreenWidth();
     float h = GetScreenHeight();
+    float size;
     if ((w * GRID_HEIGHT) < (h * GRID_WIDTH)) {
-        return (float)GetScreenWidth() / GRID_WIDTH;
+        size = (float)GetScreenWidth() / GRID_WIDTH;
+    } else {
+        size = (float)GetScreenHeight() / GRID_HEIGHT;
     }
-    return (float)GetScreenHeight() / GRID_HEIGHT;
+    // mazes that do not fit at this size scroll instead of shrinking further
+    return (size < CELL_SIZE_MIN) ? CELL_SIZE_MIN : size;
 }
 
 static inline float get_half_cell_size() {
@@ -192,6 +508,7 @@ static inline float get_eighth_cell_size() {
 #include <stdio.h>
 #define ASSERT(condition) do { are_you_a_horrible_person(condition, #condition, __FILE__, __LINE__); } while (0)
 #define GET_FRAME_TIME() (GetFrameTime() * (slowmotion ? 0.2f : 1.0f))
+#define GET_SIMULATION_TICK_INTERVAL() (SIMULATION_DELTA_TIME * (slowmotion ? 5.0f : 1.0f))
 
 bool slowmotion = false;
 void toggle_slowmotion() {
@@ -224,8 +541,8 @@ void debug_cell(GridPosition position, Color color) {
     }
 
     DrawCircleLines(
-        state->render_x_offset + (position.x * get_cell_size()) + get_half_cell_size(),
-        (position.y * get_cell_size()) + get_half_cell_size(),
+        state->render_offset.x + (position.x * get_cell_size()) + get_half_cell_size(),
+        state->render_offset.y + (position.y * get_cell_size()) + get_half_cell_size(),
         get_half_cell_size(),
         color
     );
@@ -237,10 +554,10 @@ void debug_line(GridPosition a, GridPosition b, Color color) {
     }
 
     DrawLine(
-        state->render_x_offset + (a.x * get_cell_size()) + get_half_cell_size(),
-        (a.y * get_cell_size()) + get_half_cell_size(),
-        state->render_x_offset + (b.x * get_cell_size()) + get_half_cell_size(),
-        (b.y * get_cell_size()) + get_half_cell_size(),
+        state->render_offset.x + (a.x * get_cell_size()) + get_half_cell_size(),
+        state->render_offset.y + (a.y * get_cell_size()) + get_half_cell_size(),
+        state->render_offset.x + (b.x * get_cell_size()) + get_half_cell_size(),
+        state->render_offset.y + (b.y * get_cell_size()) + get_half_cell_size(),
         color
     );
 }
@@ -248,16 +565,25 @@ void debug_line(GridPosition a, GridPosition b, Color color) {
 #else
 #define ASSERT(condition) ((void)(condition))
 #define GET_FRAME_TIME() GetFrameTime()
+#define GET_SIMULATION_TICK_INTERVAL() SIMULATION_DELTA_TIME
 #endif
 
+static inline int min_int(int a, int b) {
+    return (a < b) ? a : b;
+}
+
+static inline int max_int(int a, int b) {
+    return (a > b) ? a : b;
+}
+
 static inline bool grid_position_eq(GridPosition a, GridPosition b) {
     return a.x == b.x && a.y == b.y;
 }
 
 static inline Vector2 to_screen(GridPosition position) {
     return (Vector2) {
-        state->render_x_offset + (position.x * get_cell_size()),
-        position.y * get_cell_size(),
+        state->render_offset.x + (position.x * get_cell_size()),
+        state->render_offset.y + (position.y * get_cell_size()),
     };
 }
 
@@ -267,10 +593,10 @@ static inline int get_grid_distance_squared(GridPosition a, GridPosition b) {
     return dx * dx + dy * dy;
 }
 
-static inline float get_screen_distance(Vector2 a, Vector2 b) {
-    float dx = b.x - a.x;
-    float dy = b.y - a.y;
-    return sqrtf((dx * dx) + (dy * dy));
+static inline long long get_subcell_distance_squared(SubcellOffset a, SubcellOffset b) {
+    long long dx = b.x - a.x;
+    long long dy = b.y - a.y;
+    return (dx * dx) + (dy * dy);
 }
 
 static inline bool is_out_of_bounds(GridPosition position) {
@@ -281,24 +607,56 @@ static inline bool is_out_of_bounds(GridPosition position) {
         position.y < 0;
 }
 
+static inline int get_grid_tile_count(int cells) {
+    return (cells + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+}
+
+static inline size_t get_grid_size(int width, int height) {
+    return (size_t)get_grid_tile_count(width) * (size_t)get_grid_tile_count(height) * GRID_TILE_CELLS;
+}
+
+static inline int get_tiled_index(int tiles_x, int x, int y) {
+    int tile = ((y >> GRID_TILE_SHIFT) * tiles_x) + (x >> GRID_TILE_SHIFT);
+    return (tile * GRID_TILE_CELLS) + ((y & GRID_TILE_MASK) << GRID_TILE_SHIFT) + (x & GRID_TILE_MASK);
+}
+
+static inline int get_grid_index(GridPosition position) {
+    return get_tiled_index(state->grid_tiles_x, position.x, position.y);
+}
+
 static inline bool has_flag(GridPosition position, int flag) {
     if (is_out_of_bounds(position)) {
         return flag == FLAG_OUT_OF_BOUNDS;
     }
-    return (state->grid[position.x][position.y] & flag) == flag;
+    return (state->grid[get_grid_index(position)] & flag) == flag;
+}
+
+static inline void record_grid_change(int idx) {
+    state->grid_version++;
+    state->grid_changes[state->grid_version & (GRID_CHANGES_MAX - 1)] = idx;
 }
 
 static inline void add_flag(GridPosition position, int flag) {
     ASSERT(!is_out_of_bounds(position));
-    state->grid[position.x][position.y] |= flag;
+    int idx = get_grid_index(position);
+    state->grid[idx] |= flag;
+    record_grid_change(idx);
 }
 
 static inline void remove_flag(GridPosition position, int flag) {
     ASSERT(!is_out_of_bounds(position));
-    state->grid[position.x][position.y] &= ~flag;
+    int idx = get_grid_index(position);
+    state->grid[idx] &= ~flag;
+    record_grid_change(idx);
+}
+
+// the graph has to be the one of the current maze
+static inline const GraphCell *get_graph_cell(const MazeGraph *graph, GridPosition position) {
+    ASSERT(!is_out_of_bounds(position));
+    return &graph->cells[get_grid_index(position)];
 }
 
-static inline float get_ghost_speed(Ghost *ghost) {
+static inline int get_ghost_speed(Ghost *ghost) {
     switch (ghost->state) {
         default: ASSERT(false);
         case GHOST_STATE_INSIDE:
@@ -307,7 +665,7 @@ static inline float get_ghost_speed(Ghost *ghost) {
             return SPEED_GHOST_LEAVING;
         case GHOST_STATE_OUTSIDE:
             if (ghost == &state->ghosts[0]) {
-                return SPEED_GHOST_OUTSIDE * state->red_ghost_speed_multiplier;
+                return state->red_ghost_speed;
             }
             return SPEED_GHOST_OUTSIDE;
         case GHOST_STATE_FRIGHTENED:
@@ -317,43 +675,66 @@ static inline float get_ghost_speed(Ghost *ghost) {
     }
 }
 
-Vector2 get_player_screen_position() {
-    Vector2 result = to_screen(state->player.position);
-
-    result.x += (state->player.fraction_position.x * get_cell_size());
-    result.y += (state->player.fraction_position.y * get_cell_size());
-
-    result.x += get_half_cell_size();
-    result.y += get_half_cell_size();
-
-    return result;
+// the simulation works in subcells and never looks at the window, the center of cell (x, y) is
+// ((x * SUBCELL_COUNT) + (SUBCELL_COUNT / 2), (y * SUBCELL_COUNT) + (SUBCELL_COUNT / 2))
+SubcellOffset get_player_subcell_position() {
+    return (SubcellOffset) {
+        (state->player.position.x * SUBCELL_COUNT) + (SUBCELL_COUNT / 2) + state->player.fraction_position.x,
+        (state->player.position.y * SUBCELL_COUNT) + (SUBCELL_COUNT / 2) + state->player.fraction_position.y,
+    };
 }
 
-Vector2 get_ghost_screen_position(Ghost *ghost) {
-    Vector2 result = to_screen(ghost->position);
+SubcellOffset get_ghost_subcell_position(Ghost *ghost) {
+    SubcellOffset result = {
+        (ghost->position.x * SUBCELL_COUNT) + (SUBCELL_COUNT / 2),
+        (ghost->position.y * SUBCELL_COUNT) + (SUBCELL_COUNT / 2),
+    };
 
     switch (ghost->direction) {
         default: ASSERT(false);
         case DIRECTION_RIGHT:
-            result.x += (ghost->fraction_position * get_cell_size());
+            result.x += ghost->fraction_position;
             break;
         case DIRECTION_UP:
-            result.y -= (ghost->fraction_position * get_cell_size());
+            result.y -= ghost->fraction_position;
             break;
         case DIRECTION_LEFT:
-            result.x -= (ghost->fraction_position * get_cell_size());
+            result.x -= ghost->fraction_position;
             break;
         case DIRECTION_DOWN:
-            result.y += (ghost->fraction_position* get_cell_size());
+            result.y += ghost->fraction_position;
             break;
     }
 
-    result.x += get_half_cell_size();
-    result.y += get_half_cell_size();
-
     return result;
 }
 
+// the same positions in cells, for everything that is not the simulation
+Vector2 get_player_grid_position() {
+    SubcellOffset position = get_player_subcell_position();
+    return (Vector2) { SUBCELLS_TO_CELLS(position.x), SUBCELLS_TO_CELLS(position.y) };
+}
+
+Vector2 get_ghost_grid_position(Ghost *ghost) {
+    SubcellOffset position = get_ghost_subcell_position(ghost);
+    return (Vector2) { SUBCELLS_TO_CELLS(position.x), SUBCELLS_TO_CELLS(position.y) };
+}
+
+static inline Vector2 grid_to_screen(Vector2 position) {
+    return (Vector2) {
+        state->render_offset.x + (position.x * get_cell_size()),
+        state->render_offset.y + (position.y * get_cell_size()),
+    };
+}
+
+Vector2 get_player_screen_position() {
+    return grid_to_screen(get_player_grid_position());
+}
+
+Vector2 get_ghost_screen_position(Ghost *ghost) {
+    return grid_to_screen(get_ghost_grid_position(ghost));
+}
+
 GridPosition get_position_in_direction(GridPosition from, int direction, int multiplier) {
     switch (direction) {
         default:                return (GridPosition) {from.x,                  from.y};
@@ -364,6 +745,16 @@ GridPosition get_position_in_direction(GridPosition from, int direction, int mul
     }
 }
 
+int get_opposite_direction(int direction) {
+    switch (direction) {
+        default: return DIRECTION_NONE;
+        case DIRECTION_RIGHT: return DIRECTION_LEFT;
+        case DIRECTION_UP: return DIRECTION_DOWN;
+        case DIRECTION_LEFT: return DIRECTION_RIGHT;
+        case DIRECTION_DOWN: return DIRECTION_UP;
+    }
+}
+
 GridPosition wrap_teleport(GridPosition position) {
     if (position.x < 0) {
         position.x = GRID_WIDTH;
@@ -394,11 +785,11 @@ GridPosition get_pinky_target(void) {
     }
 
     Ghost *pinky = &state->ghosts[GHOST_PINKY];
-    float distance_to_player = get_screen_distance(
-        get_ghost_screen_position(pinky),
-        get_player_screen_position()
+    long long distance_squared = get_subcell_distance_squared(
+        get_ghost_subcell_position(pinky),
+        get_player_subcell_position()
     );
-    int cells_from_player = distance_to_player / get_cell_size();
+    int cells_from_player = (int)sqrt((double)distance_squared) / SUBCELL_COUNT;
 
     return get_position_in_direction(state->player.position, state->player.direction, cells_from_player);
 }
@@ -444,215 +835,2879 @@ GridPosition get_clyde_target(void) {
     return GRID_BOTTOM_LEFT;
 }
 
-float get_level_var_increasing(float start, float target) {
+// moves from start towards target over LEVEL_MAX_CHANGE levels, rounded towards zero
+int get_level_var(int start, int target) {
     if (state->level_idx >= LEVEL_MAX_CHANGE) {
         return target;
     }
-    float diff = target - start;
-    float multiplier = (float)state->level_idx / LEVEL_MAX_CHANGE;
-    return start + (diff * multiplier);
+    return ((start * LEVEL_MAX_CHANGE) + ((target - start) * state->level_idx)) / LEVEL_MAX_CHANGE;
 }
 
-float get_level_var_decreasing(float start, float target) {
-    if (state->level_idx >= LEVEL_MAX_CHANGE) {
-        return target;
-    }
-    float diff = start - target;
-    float multiplier = (float)state->level_idx / (float)LEVEL_MAX_CHANGE;
-    return start - (diff * multiplier);
+#if defined(_WIN32)
+__declspec(dllimport) int __stdcall QueryPerformanceCounter(long long *count);
+__declspec(dllimport) int __stdcall QueryPerformanceFrequency(long long *frequency);
+#endif
+
+// seconds from an arbitrary point, unlike GetTime() this works without a window and from any thread
+double get_wall_time(void) {
+#if defined(_WIN32)
+    long long count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count / (double)frequency;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec * 1e-9);
+#endif
 }
 
-void level_setup() {
-    state->death_by_ghost = NULL;
-    state->level_idx++;
-    state->level_intro = 0;
+typedef struct {
+    const char *name;
+    const char *detail;
+    double time;
+} StartupPhase;
 
-    state->level_scatter_min = get_level_var_decreasing(2, 0);
-    state->level_scatter_max = get_level_var_decreasing(5, 1);
-    state->level_chase_min = get_level_var_increasing(5,10);
-    state->level_chase_max = get_level_var_increasing(10,20);
-    state->red_ghost_speed_multiplier = get_level_var_increasing(1.2f, 1.5f);
-
-    state->ghost_scatter_timer = 0.0f;
-    state->ghost_scatter_target_time = GetRandomValue(state->level_scatter_min, state->level_scatter_max);
-
-    state->dot_count = 0;
-
-    char byte_grid[GRID_WIDTH][GRID_HEIGHT] = {
-        "########## ###########",
-        "#.*....### ###..*#...#",
-        "#.##.#.### ###.#...#.#",
-        "#.##.#.### ###.###.#.#",
-        "#..................#.#",
-        "#.##.##### ###.#.###.#",
-        "#.##...#      .#...#.#",
-        "#.##.#.# ### #.#.#.#.#",
-        "#....#.  # # #...#...#",
-        "####.### # # ### ###.#",
-        "#....#.  # # #...#...#",
-        "#.##.#.# ### #.#.#.#.#",
-        "#.##...#      .#...#.#",
-        "#.##.#####.###.#.###.#",
-        "#..................#.#",
-        "#.##.#.### ###.###.#.#",
-        "#.##.#.### ###.#...#.#",
-        "#.*....### ###..*#...#",
-        "########## ###########",
-    };
-    for (int x = 0; x < GRID_WIDTH; x++) {
-        for (int y = 0; y < GRID_HEIGHT; y++) {
-            switch (byte_grid[x][y]) {
-                case '#':
-                    state->grid[x][y] = FLAG_WALL;
-                    break;
-                case '.':
-                    state->dot_count++;
-                    state->grid[x][y] = FLAG_DOT;
-                    break;
-                case '*':
-                    state->dot_count++;
-                    state->grid[x][y] = FLAG_BIG_DOT;
-                    break;
-                default:
-                    state->grid[x][y] = FLAG_NONE;
-                    break;
-            }
-        }
-    }
+// --measure-startup, timestamps of every step from entering main() to the first presented frame
+typedef struct {
+    bool enabled;
+    int count;
+    StartupPhase phases[STARTUP_PHASES_MAX];
+} StartupProfile;
 
-    for (int x = 0; x < GRID_WIDTH; x++) {
-        for (int y = 0; y < GRID_HEIGHT; y++) {
-            GridPosition g = { x, y };
-            if (has_flag(get_position_in_direction(g, DIRECTION_RIGHT, 1), FLAG_WALL)) { add_flag(g, FLAG_WALL_TO_RIGHT); }
-            if (has_flag(get_position_in_direction(g, DIRECTION_UP, 1), FLAG_WALL)) { add_flag(g, FLAG_WALL_ABOVE); }
-            if (has_flag(get_position_in_direction(g, DIRECTION_LEFT, 1), FLAG_WALL)) { add_flag(g, FLAG_WALL_TO_LEFT); }
-            if (has_flag(get_position_in_direction(g, DIRECTION_DOWN, 1), FLAG_WALL)) { add_flag(g, FLAG_WALL_BELOW); }
-        }
+StartupProfile startup_profile;
+
+// safe to call from the asset loader thread too
+void mark_startup_phase_at(const char *name, const char *detail, double time) {
+    if (!startup_profile.enabled) {
+        return;
+    }
+    int idx = __atomic_fetch_add(&startup_profile.count, 1, __ATOMIC_RELAXED);
+    if (idx < STARTUP_PHASES_MAX) {
+        startup_profile.phases[idx] = (StartupPhase) {
+            .name = name,
+            .detail = detail,
+            .time = time,
+        };
     }
+}
 
-    state->ghost_phase = PHASE_SCATTER;
+void mark_startup_phase(const char *name, const char *detail) {
+    mark_startup_phase_at(name, detail, get_wall_time());
+}
 
-    state->ghost_frightened_target_time = (state->level_idx < 10) ? (10 - state->level_idx) : 0;
+static int compare_startup_phases(const void *a, const void *b) {
+    double ta = ((const StartupPhase *)a)->time;
+    double tb = ((const StartupPhase *)b)->time;
+    return (ta > tb) - (ta < tb);
+}
 
-    state->player = (Player) {
-        .position = CELL_PLAYER_START,
-        .direction = DIRECTION_NONE,
-        .requested_direction = DIRECTION_NONE,
-        .fraction_position = (Vector2) {0},
-    };
+void print_startup_profile(void) {
+    int count = startup_profile.count < STARTUP_PHASES_MAX ? startup_profile.count : STARTUP_PHASES_MAX;
+    StartupPhase *phases = startup_profile.phases;
+    qsort(phases, count, sizeof(StartupPhase), compare_startup_phases);
 
-    state->ghosts[GHOST_BLINKY].state = GHOST_STATE_OUTSIDE;
-    state->ghosts[GHOST_BLINKY].shape = GHOST_SHAPE_TRAPEZOID;
-    state->ghosts[GHOST_BLINKY].position = CELL_OUTSIDE_GHOST_HOUSE_DOOR;
-    state->ghosts[GHOST_BLINKY].direction = DIRECTION_LEFT;
-    state->ghosts[GHOST_BLINKY].color = COLOR_BLINKY;
-    state->ghosts[GHOST_BLINKY].get_target = get_blinky_target;
+    printf("\n%-24s %-16s %12s %12s\n", "phase", "", "since start", "delta");
+    for (int i = 0; i < count; i++) {
+        double since_start = (phases[i].time - phases[0].time) * 1000.0;
+        double delta = (i > 0) ? (phases[i].time - phases[i - 1].time) * 1000.0 : 0.0;
+        printf("%-24s %-16s %9.3f ms %9.3f ms\n", phases[i].name, phases[i].detail ? phases[i].detail : "", since_start, delta);
+    }
+}
 
-    state->ghosts[GHOST_PINKY].state = GHOST_STATE_INSIDE;
-    state->ghosts[GHOST_PINKY].shape = GHOST_SHAPE_TRAPEZOID;
-    state->ghosts[GHOST_PINKY].position = CELL_GHOST_HOUSE_LEFT_SIDE;
-    state->ghosts[GHOST_PINKY].direction = DIRECTION_RIGHT;
-    state->ghosts[GHOST_PINKY].color = COLOR_PINKY;
-    state->ghosts[GHOST_PINKY].get_target = get_pinky_target;
+typedef struct {
+    const char *name;
+    const char *detail;
+    double start;
+    double duration;
+} TraceEvent;
 
-    state->ghosts[GHOST_INKY].state = GHOST_STATE_INSIDE;
-    state->ghosts[GHOST_INKY].shape = GHOST_SHAPE_TRAPEZOID;
-    state->ghosts[GHOST_INKY].position = CELL_GHOST_HOUSE_CENTER;
-    state->ghosts[GHOST_INKY].direction = DIRECTION_RIGHT;
-    state->ghosts[GHOST_INKY].color = COLOR_INKY;
-    state->ghosts[GHOST_INKY].get_target = get_inky_target;
+// one per thread, only the owning thread writes to it so recording needs no lock
+typedef struct {
+    int thread_id;
+    const char *thread_name;
+    int generation; // of the capture the events belong to, the owner empties the buffer when a new capture started
+    int count;
+    int dropped;
+    TraceEvent events[TRACE_EVENTS_MAX];
+} TraceBuffer;
 
-    state->ghosts[GHOST_CLYDE].state = GHOST_STATE_INSIDE;
-    state->ghosts[GHOST_CLYDE].shape = GHOST_SHAPE_TRAPEZOID;
-    state->ghosts[GHOST_CLYDE].position = CELL_GHOST_HOUSE_RIGHT_SIDE;
-    state->ghosts[GHOST_CLYDE].direction = DIRECTION_LEFT;
-    state->ghosts[GHOST_CLYDE].color = COLOR_CLYDE;
-    state->ghosts[GHOST_CLYDE].get_target = get_clyde_target;
+// chrome://tracing / Perfetto compatible capture, --trace <file> records the whole run, F9 toggles a capture
+typedef struct {
+    const char *file_name;
+    int recording;
+    int generation; // bumped by every start_trace()
+    double start_time;
+    pthread_mutex_t mutex; // only taken when a thread registers its buffer
+    int buffer_count;
+    TraceBuffer *buffers[TRACE_THREADS_MAX];
+} Trace;
+
+Trace trace = {
+    .file_name = TRACE_DEFAULT_FILE,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
 
-    ASSERT(state->level_idx > 0);
-    switch (state->level_idx) {
-        case 1:
-            state->ghosts[GHOST_BLINKY].wait_amount = 0;
-            state->ghosts[GHOST_PINKY].wait_amount = 2;
-            state->ghosts[GHOST_INKY].wait_amount = 22;
-            state->ghosts[GHOST_CLYDE].wait_amount = 42;
-            break;
-        case 2:
-            state->ghosts[GHOST_BLINKY].wait_amount = 0;
-            state->ghosts[GHOST_PINKY].wait_amount = 2;
-            state->ghosts[GHOST_INKY].wait_amount = 4;
-            state->ghosts[GHOST_CLYDE].wait_amount = 24;
-            break;
-        case 3:
-            state->ghosts[GHOST_BLINKY].wait_amount = 0;
-            state->ghosts[GHOST_PINKY].wait_amount = 2;
-            state->ghosts[GHOST_INKY].wait_amount = 4;
-            state->ghosts[GHOST_CLYDE].wait_amount = 6;
-            break;
-    }
-}
+__thread TraceBuffer *trace_buffer;
+__thread const char *trace_thread_name;
 
-void init(void) {
-    level_setup();
+// names the calling thread in the capture, call before its first trace_end()
+void set_trace_thread_name(const char *name) {
+    trace_thread_name = name;
+}
 
-    state->ghost_frightened_texture = LoadTexture("frightened.png");
-    state->ghost_returning_texture = LoadTexture("returning.png");
+static TraceBuffer *get_trace_buffer(void) {
+    if (trace_buffer != NULL) {
+        return trace_buffer;
+    }
+    pthread_mutex_lock(&trace.mutex);
+    if (trace.buffer_count < TRACE_THREADS_MAX) {
+        TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+        if (buffer != NULL) {
+            buffer->thread_id = trace.buffer_count + 1;
+            buffer->thread_name = trace_thread_name ? trace_thread_name : "thread";
+            trace.buffers[trace.buffer_count] = buffer;
+            __atomic_store_n(&trace.buffer_count, trace.buffer_count + 1, __ATOMIC_RELEASE);
+            trace_buffer = buffer;
+        }
+    }
+    pthread_mutex_unlock(&trace.mutex);
+    return trace_buffer;
+}
 
-    state->ghosts[GHOST_BLINKY].texture = LoadTexture("blinky.png");
-    state->ghosts[GHOST_PINKY].texture = LoadTexture("pinky.png");
-    state->ghosts[GHOST_INKY].texture = LoadTexture("inky.png");
-    state->ghosts[GHOST_CLYDE].texture = LoadTexture("clyde.png");
+static inline double trace_begin(void) {
+    return __atomic_load_n(&trace.recording, __ATOMIC_RELAXED) ? get_wall_time() : 0.0;
 }
 
-int get_opposite_direction(int direction) {
-    switch (direction) {
-        default: return DIRECTION_NONE;
-        case DIRECTION_RIGHT: return DIRECTION_LEFT;
-        case DIRECTION_UP: return DIRECTION_DOWN;
-        case DIRECTION_LEFT: return DIRECTION_RIGHT;
-        case DIRECTION_DOWN: return DIRECTION_UP;
+void trace_end_detail(const char *name, const char *detail, double start) {
+    if (start == 0.0 || !__atomic_load_n(&trace.recording, __ATOMIC_RELAXED)) {
+        return;
     }
+    double end = get_wall_time();
+    TraceBuffer *buffer = get_trace_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    int generation = __atomic_load_n(&trace.generation, __ATOMIC_ACQUIRE);
+    if (buffer->generation != generation) {
+        buffer->count = 0;
+        buffer->dropped = 0;
+        __atomic_store_n(&buffer->generation, generation, __ATOMIC_RELEASE);
+    }
+    int idx = buffer->count;
+    if (idx >= TRACE_EVENTS_MAX) {
+        buffer->dropped++;
+        return;
+    }
+    buffer->events[idx] = (TraceEvent) {
+        .name = name,
+        .detail = detail,
+        .start = start,
+        .duration = end - start,
+    };
+    __atomic_store_n(&buffer->count, idx + 1, __ATOMIC_RELEASE);
 }
 
-void player_on_position_new() {
-    Player *player = &state->player;
-
-    player->fraction_position = (Vector2){0};
-    player->position = wrap_teleport(player->position);
+static inline void trace_end(const char *name, double start) {
+    trace_end_detail(name, NULL, start);
+}
 
-    if (has_flag(player->position, FLAG_DOT)) {
-        remove_flag(player->position, FLAG_DOT);
-        state->dot_count--;
-    } else if (has_flag(player->position, FLAG_BIG_DOT)) {
-        remove_flag(player->position, FLAG_BIG_DOT);
-        state->dot_count--;
+// the buffers belong to their threads, they are emptied by their owners on their next event
+void start_trace(void) {
+    __atomic_add_fetch(&trace.generation, 1, __ATOMIC_RELEASE);
+    if (trace.start_time == 0.0) {
+        trace.start_time = get_wall_time();
+    }
+    __atomic_store_n(&trace.recording, 1, __ATOMIC_RELEASE);
+}
 
-        state->ghost_phase = PHASE_FRIGHTENED;
-        state->ghost_frightened_timer = 0.0f;
+// stops recording and writes everything captured so far as Trace Event Format json
+bool stop_trace(void) {
+    if (!__atomic_exchange_n(&trace.recording, 0, __ATOMIC_ACQ_REL)) {
+        return true;
+    }
+    FILE *file = fopen(trace.file_name, "w");
+    if (file == NULL) {
+        TraceLog(LOG_ERROR, "TRACE: [%s] Failed to open trace file", trace.file_name);
+        return false;
+    }
 
-        for (int i = 0; i < GHOST_COUNT; i++) {
-            Ghost *ghost = &state->ghosts[i];
-            switch (ghost->state) {
-                default:
-                    break;
-                case GHOST_STATE_OUTSIDE:
-                    ghost->state = GHOST_STATE_FRIGHTENED;
-                    break;
+    int event_count = 0;
+    int dropped = 0;
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int buffer_count = __atomic_load_n(&trace.buffer_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < buffer_count; i++) {
+        TraceBuffer *buffer = trace.buffers[i];
+        fprintf(
+            file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", buffer->thread_id, buffer->thread_name
+        );
+        first = false;
+
+        // a thread without events in this capture still holds the previous one
+        bool current = __atomic_load_n(&buffer->generation, __ATOMIC_ACQUIRE) == trace.generation;
+        int count = current ? __atomic_load_n(&buffer->count, __ATOMIC_ACQUIRE) : 0;
+        for (int j = 0; j < count; j++) {
+            TraceEvent *event = &buffer->events[j];
+            fprintf(
+                file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f",
+                event->name, buffer->thread_id, (event->start - trace.start_time) * 1e6, event->duration * 1e6
+            );
+            if (event->detail) {
+                fprintf(file, ",\"args\":{\"detail\":\"%s\"}", event->detail);
             }
+            fprintf(file, "}");
         }
+        event_count += count;
+        dropped += current ? buffer->dropped : 0;
     }
+    fprintf(file, "\n]}\n");
+    fclose(file);
 
-    if (state->dot_count == 0) {
-        level_setup();
+    TraceLog(LOG_INFO, "TRACE: [%s] %i events from %i threads written, %i dropped", trace.file_name, event_count, buffer_count, dropped);
+    return true;
+}
+
+void toggle_trace(void) {
+    if (__atomic_load_n(&trace.recording, __ATOMIC_RELAXED)) {
+        stop_trace();
+    } else {
+        TraceLog(LOG_INFO, "TRACE: Recording, press F9 again to write [%s]", trace.file_name);
+        start_trace();
     }
 }
 
-void scan_surroundings(GridPosition from, int current_direction, Surroundings *surroundings) {
-    ASSERT(surroundings->count == 0);
+void free_trace(void) {
+    for (int i = 0; i < trace.buffer_count; i++) {
+        free(trace.buffers[i]);
+        trace.buffers[i] = NULL;
+    }
+    trace.buffer_count = 0;
+}
 
-    for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
-        int opposite_direction = get_opposite_direction(current_direction);
-        if (direction == opposite_direction) {
+// splitmix64, small and good enough, and unlike GetRandomValue() every user can have its own sequence
+static inline unsigned long long rng_next(Rng *rng) {
+    unsigned long long z = (rng->state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// [0, count)
+static inline int rng_range(Rng *rng, int count) {
+    ASSERT(count > 0);
+    return (int)(rng_next(rng) % (unsigned long long)count);
+}
+
+// [min, max], same contract as GetRandomValue()
+static inline int rng_between(Rng *rng, int min, int max) {
+    if (min > max) {
+        int tmp = min;
+        min = max;
+        max = tmp;
+    }
+    return min + rng_range(rng, max - min + 1);
+}
+
+static const char builtin_maze[BUILTIN_MAZE_WIDTH][BUILTIN_MAZE_HEIGHT] = {
+    "########## ###########",
+    "#.*....### ###..*#...#",
+    "#.##.#.### ###.#...#.#",
+    "#.##.#.### ###.###.#.#",
+    "#..................#.#",
+    "#.##.##### ###.#.###.#",
+    "#.##...#      .#...#.#",
+    "#.##.#.# ### #.#.#.#.#",
+    "#....#.  # # #...#...#",
+    "####.### # # ### ###.#",
+    "#....#.  # # #...#...#",
+    "#.##.#.# ### #.#.#.#.#",
+    "#.##...#      .#...#.#",
+    "#.##.#####.###.#.###.#",
+    "#..................#.#",
+    "#.##.#.### ###.###.#.#",
+    "#.##.#.### ###.#...#.#",
+    "#.*....### ###..*#...#",
+    "########## ###########",
+};
+
+static inline unsigned char *get_maze_cells(LevelHeader *header) {
+    return (unsigned char *)(header + 1);
+}
+
+static inline size_t get_maze_size(int width, int height) {
+    return sizeof(LevelHeader) + get_grid_size(width, height);
+}
+
+static inline unsigned int get_maze_checksum(const LevelHeader *header, size_t size) {
+    size_t offset = offsetof(LevelHeader, width);
+    return ComputeCRC32((unsigned char *)header + offset, (int)(size - offset));
+}
+
+// fills in everything derived from the wall/dot flags, so every maze source only has to place walls, dots and the ghost house
+void maze_finalize(LevelHeader *header) {
+    unsigned char *cells = get_maze_cells(header);
+    int width = header->width;
+    int height = header->height;
+    int tiles_x = get_grid_tile_count(width);
+
+    header->magic = LEVEL_FILE_MAGIC;
+    header->version = LEVEL_FILE_VERSION;
+    header->dot_count = 0;
+    header->tunnel_count = 0;
+
+    for (int x = 0; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+            unsigned char *cell = &cells[get_tiled_index(tiles_x, x, y)];
+            *cell &= (FLAG_WALL | FLAG_DOT | FLAG_BIG_DOT);
+
+            if (*cell & (FLAG_DOT | FLAG_BIG_DOT)) {
+                header->dot_count++;
+            }
+
+            GridPosition g = { x, y };
+            for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+                GridPosition n = get_position_in_direction(g, direction, 1);
+                bool outside = n.x < 0 || n.y < 0 || n.x >= width || n.y >= height;
+                if (outside) {
+                    if (!(*cell & FLAG_WALL) && header->tunnel_count < LEVEL_TUNNELS_MAX) {
+                        header->tunnels[header->tunnel_count] = g;
+                        header->tunnel_count++;
+                    }
+                    continue;
+                }
+                if (!(cells[get_tiled_index(tiles_x, n.x, n.y)] & FLAG_WALL)) {
+                    continue;
+                }
+                switch (direction) {
+                    case DIRECTION_RIGHT: *cell |= FLAG_WALL_TO_RIGHT; break;
+                    case DIRECTION_UP: *cell |= FLAG_WALL_ABOVE; break;
+                    case DIRECTION_LEFT: *cell |= FLAG_WALL_TO_LEFT; break;
+                    case DIRECTION_DOWN: *cell |= FLAG_WALL_BELOW; break;
+                }
+            }
+        }
+    }
+
+    header->checksum = get_maze_checksum(header, get_maze_size(width, height));
+}
+
+bool maze_create_builtin(Maze *maze) {
+    size_t size = get_maze_size(BUILTIN_MAZE_WIDTH, BUILTIN_MAZE_HEIGHT);
+    LevelHeader *header = calloc(size, 1);
+    if (header == NULL) {
+        return false;
+    }
+
+    header->width = BUILTIN_MAZE_WIDTH;
+    header->height = BUILTIN_MAZE_HEIGHT;
+    header->player_start = (GridPosition){9,16};
+    header->outside_ghost_house_door = (GridPosition){9,8};
+    header->ghost_house_door = (GridPosition){9,9};
+    header->ghost_house_center = (GridPosition){9,10};
+    header->ghost_house_left_side = (GridPosition){8,10};
+    header->ghost_house_right_side = (GridPosition){10,10};
+
+    unsigned char *cells = get_maze_cells(header);
+    int tiles_x = get_grid_tile_count(BUILTIN_MAZE_WIDTH);
+    memset(cells, FLAG_WALL, get_grid_size(BUILTIN_MAZE_WIDTH, BUILTIN_MAZE_HEIGHT));
+    for (int x = 0; x < BUILTIN_MAZE_WIDTH; x++) {
+        for (int y = 0; y < BUILTIN_MAZE_HEIGHT; y++) {
+            unsigned char *cell = &cells[get_tiled_index(tiles_x, x, y)];
+            switch (builtin_maze[x][y]) {
+                case '#': *cell = FLAG_WALL; break;
+                case '.': *cell = FLAG_DOT; break;
+                case '*': *cell = FLAG_BIG_DOT; break;
+                default: *cell = FLAG_NONE; break;
+            }
+        }
+    }
+
+    maze_finalize(header);
+
+    *maze = (Maze) {
+        .header = header,
+        .cells = cells,
+        .memory = header,
+        .size = size,
+        .mapped = false,
+    };
+    return true;
+}
+
+static bool is_maze_position_valid(const LevelHeader *header, GridPosition position) {
+    return position.x >= 0 && position.y >= 0 && position.x < header->width && position.y < header->height;
+}
+
+static bool is_maze_valid(const char *file_name, const void *memory, size_t size) {
+    const LevelHeader *header = memory;
+
+    if (size < sizeof(LevelHeader) || header->magic != LEVEL_FILE_MAGIC) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Not a level file", file_name);
+        return false;
+    }
+    if (header->version != LEVEL_FILE_VERSION) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Unsupported version %u", file_name, header->version);
+        return false;
+    }
+    if (header->width <= 0 || header->height <= 0 || header->width > GRID_SIZE_MAX || header->height > GRID_SIZE_MAX) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Maze is %ix%i but at most %ix%i is supported", file_name, header->width, header->height, GRID_SIZE_MAX, GRID_SIZE_MAX);
+        return false;
+    }
+    if (size != get_maze_size(header->width, header->height)) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Size %zu does not match the header", file_name, size);
+        return false;
+    }
+    if (header->checksum != get_maze_checksum(header, size)) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Checksum mismatch", file_name);
+        return false;
+    }
+
+    GridPosition positions[] = {
+        header->player_start,
+        header->outside_ghost_house_door,
+        header->ghost_house_door,
+        header->ghost_house_center,
+        header->ghost_house_left_side,
+        header->ghost_house_right_side,
+    };
+    for (int i = 0; i < (int)(sizeof(positions) / sizeof(positions[0])); i++) {
+        if (!is_maze_position_valid(header, positions[i])) {
+            TraceLog(LOG_WARNING, "LEVEL: [%s] Spawn or ghost house cell out of bounds", file_name);
+            return false;
+        }
+    }
+
+    if (header->tunnel_count < 0 || header->tunnel_count > LEVEL_TUNNELS_MAX || header->dot_count <= 0) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Bad tunnel or dot count", file_name);
+        return false;
+    }
+    for (int i = 0; i < header->tunnel_count; i++) {
+        if (!is_maze_position_valid(header, header->tunnels[i])) {
+            TraceLog(LOG_WARNING, "LEVEL: [%s] Tunnel %i out of bounds", file_name, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// maps the file read-only, the cells are used straight from the page cache
+// on windows the whole file is read instead since there is no mmap, "mapped" then means owned by raylib
+bool maze_load(Maze *maze, const char *file_name) {
+    void *memory = NULL;
+    size_t size = 0;
+    bool mapped = false;
+
+#if defined(_WIN32)
+    int data_size = 0;
+    memory = LoadFileData(file_name, &data_size);
+    if (memory == NULL) {
+        return false;
+    }
+    size = (size_t)data_size;
+    mapped = true;
+#else
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Failed to open file", file_name);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Failed to stat file", file_name);
+        return false;
+    }
+    size = (size_t)st.st_size;
+    memory = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        TraceLog(LOG_WARNING, "LEVEL: [%s] Failed to map file", file_name);
+        return false;
+    }
+    mapped = true;
+#endif
+
+    if (!is_maze_valid(file_name, memory, size)) {
+#if defined(_WIN32)
+        UnloadFileData(memory);
+#else
+        munmap(memory, size);
+#endif
+        return false;
+    }
+
+    *maze = (Maze) {
+        .header = memory,
+        .cells = (const unsigned char *)((const LevelHeader *)memory + 1),
+        .memory = memory,
+        .size = size,
+        .mapped = mapped,
+    };
+    return true;
+}
+
+void maze_graph_free(MazeGraph *graph) {
+    free(graph->nodes);
+    free(graph->edges);
+    free(graph->edge_cells);
+    free(graph->cells);
+    *graph = (MazeGraph) {0};
+}
+
+void path_hierarchy_free(PathHierarchy *paths) {
+    if (paths->clusters) {
+        for (int i = 0; i < paths->clusters_x * paths->clusters_y; i++) {
+            free(paths->clusters[i].distances);
+        }
+    }
+    free(paths->clusters);
+    for (int i = 0; i < PATH_FIELDS_MAX; i++) {
+        PathField *field = &paths->fields[i];
+        free(field->distances);
+        free(field->seen);
+        free(field->settled);
+        free(field->heap);
+    }
+    free(paths->flow.distances);
+    free(paths->flow.seen);
+    free(paths->flow.queue);
+    *paths = (PathHierarchy) {0};
+}
+
+void maze_unload(Maze *maze) {
+    maze_graph_free(&maze->graph);
+    path_hierarchy_free(&maze->paths);
+    free(maze->heatmap.visits);
+
+    if (!maze->mapped) {
+        free(maze->memory);
+        return;
+    }
+#if defined(_WIN32)
+    UnloadFileData(maze->memory);
+#else
+    munmap(maze->memory, maze->size);
+#endif
+}
+
+bool maze_save(const Maze *maze, const char *file_name) {
+    return SaveFileData(file_name, maze->memory, (int)maze->size);
+}
+
+// one step like the actors take it, leaving the grid comes back in on the other side like wrap_teleport()
+static bool graph_step(const Maze *maze, int tiles_x, GridPosition *position, int direction, int *length) {
+    int width = maze->header->width;
+    int height = maze->header->height;
+    GridPosition next = get_position_in_direction(*position, direction, 1);
+    int steps = 1;
+    if (next.x < 0 || next.x >= width || next.y < 0 || next.y >= height) {
+        next.x = (next.x + width) % width;
+        next.y = (next.y + height) % height;
+        steps = 2;
+    }
+    if (maze->cells[get_tiled_index(tiles_x, next.x, next.y)] & FLAG_WALL) {
+        return false;
+    }
+    *position = next;
+    *length += steps;
+    return true;
+}
+
+static int get_graph_exits(const Maze *maze, int tiles_x, GridPosition position, int *exits) {
+    int count = 0;
+    for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+        GridPosition next = position;
+        int length = 0;
+        if (graph_step(maze, tiles_x, &next, direction, &length)) {
+            exits[count++] = direction;
+        }
+    }
+    return count;
+}
+
+static int add_graph_node(MazeGraph *graph, int tiles_x, GridPosition position) {
+    int node = graph->node_count++;
+    graph->nodes[node] = (GraphNode) { .position = position, .edges = {-1, -1, -1, -1} };
+    graph->cells[get_tiled_index(tiles_x, position.x, position.y)].node = node;
+    return node;
+}
+
+// follows every corridor leaving the node that has not been followed from its other end yet
+static void trace_graph_edges(MazeGraph *graph, const Maze *maze, int tiles_x, int node) {
+    int exits[4];
+    int exit_count = get_graph_exits(maze, tiles_x, graph->nodes[node].position, exits);
+    for (int i = 0; i < exit_count; i++) {
+        if (graph->nodes[node].edges[exits[i] - DIRECTION_RIGHT] != -1) {
+            continue;
+        }
+
+        int idx = graph->edge_count++;
+        GraphEdge *edge = &graph->edges[idx];
+        *edge = (GraphEdge) { .from = node, .from_direction = exits[i], .first_cell = graph->edge_cell_count };
+        graph->nodes[node].edges[exits[i] - DIRECTION_RIGHT] = idx;
+
+        GridPosition position = graph->nodes[node].position;
+        int direction = exits[i];
+        graph_step(maze, tiles_x, &position, direction, &edge->length);
+        GraphCell *cell = &graph->cells[get_tiled_index(tiles_x, position.x, position.y)];
+        while (cell->node == -1) {
+            cell->edge = idx;
+            cell->offset = edge->length;
+            graph->edge_cells[graph->edge_cell_count++] = get_tiled_index(tiles_x, position.x, position.y);
+
+            int corridor_exits[4];
+            int corridor_exit_count = get_graph_exits(maze, tiles_x, position, corridor_exits);
+            ASSERT(corridor_exit_count == 2);
+            direction = (corridor_exits[0] == get_opposite_direction(direction)) ? corridor_exits[1] : corridor_exits[0];
+            graph_step(maze, tiles_x, &position, direction, &edge->length);
+            cell = &graph->cells[get_tiled_index(tiles_x, position.x, position.y)];
+        }
+
+        edge->to = cell->node;
+        edge->to_direction = get_opposite_direction(direction);
+        edge->cell_count = graph->edge_cell_count - edge->first_cell;
+        graph->nodes[edge->to].edges[edge->to_direction - DIRECTION_RIGHT] = idx;
+    }
+}
+
+bool maze_graph_build(MazeGraph *graph, const Maze *maze, int tiles_x, size_t grid_size) {
+    int width = maze->header->width;
+    int height = maze->header->height;
+
+    int walkable = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            walkable += !(maze->cells[get_tiled_index(tiles_x, x, y)] & FLAG_WALL);
+        }
+    }
+
+    // every walkable cell is at most one node or one corridor cell, a node has at most four edge ends
+    *graph = (MazeGraph) {0};
+    graph->nodes = malloc(sizeof(GraphNode) * walkable);
+    graph->edges = malloc(sizeof(GraphEdge) * walkable * 2);
+    graph->edge_cells = malloc(sizeof(int) * walkable);
+    graph->cells = malloc(sizeof(GraphCell) * grid_size);
+    if (!graph->nodes || !graph->edges || !graph->edge_cells || !graph->cells) {
+        maze_graph_free(graph);
+        return false;
+    }
+    for (size_t i = 0; i < grid_size; i++) {
+        graph->cells[i] = (GraphCell) { .node = -1, .edge = -1 };
+    }
+
+    int exits[4];
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            GridPosition position = {x, y};
+            bool wall = maze->cells[get_tiled_index(tiles_x, x, y)] & FLAG_WALL;
+            if (!wall && get_graph_exits(maze, tiles_x, position, exits) != 2) {
+                add_graph_node(graph, tiles_x, position);
+            }
+        }
+    }
+    int junction_count = graph->node_count;
+    for (int i = 0; i < junction_count; i++) {
+        trace_graph_edges(graph, maze, tiles_x, i);
+    }
+
+    // whatever is left are loops without a junction
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int idx = get_tiled_index(tiles_x, x, y);
+            if (!(maze->cells[idx] & FLAG_WALL) && graph->cells[idx].node == -1 && graph->cells[idx].edge == -1) {
+                trace_graph_edges(graph, maze, tiles_x, add_graph_node(graph, tiles_x, (GridPosition) {x, y}));
+            }
+        }
+    }
+
+    TraceLog(
+        LOG_DEBUG, "LEVEL: Maze graph has %i nodes and %i edges for %i walkable cells",
+        graph->node_count, graph->edge_count, walkable
+    );
+    graph->built = true;
+    return true;
+}
+
+static inline bool is_path_cell_open(const PathHierarchy *paths, const unsigned char *cells, int x, int y) {
+    return !(cells[get_tiled_index(paths->tiles_x, x, y)] & FLAG_WALL);
+}
+
+static inline int get_path_cluster_index(const PathHierarchy *paths, int x, int y) {
+    return ((y / PATH_CLUSTER_SIZE) * paths->clusters_x) + (x / PATH_CLUSTER_SIZE);
+}
+
+// the cluster across the given side, wrapping around the maze like the tunnels do
+static int get_path_neighbor_cluster(const PathHierarchy *paths, int cluster, int side, int *cost) {
+    GridPosition next = get_position_in_direction(
+        (GridPosition) {cluster % paths->clusters_x, cluster / paths->clusters_x},
+        side + DIRECTION_RIGHT,
+        1
+    );
+    *cost = 1;
+    if (next.x < 0 || next.x >= paths->clusters_x || next.y < 0 || next.y >= paths->clusters_y) {
+        next.x = (next.x + paths->clusters_x) % paths->clusters_x;
+        next.y = (next.y + paths->clusters_y) % paths->clusters_y;
+        *cost = 2;
+    }
+    return (next.y * paths->clusters_x) + next.x;
+}
+
+// breadth first inside the cluster only, PATH_UNREACHABLE where the start can not get to without leaving
+static void get_path_cluster_distances(
+    const PathHierarchy *paths, const unsigned char *cells, const PathCluster *cluster, int start, unsigned short *distances
+) {
+    unsigned char queue[PATH_CLUSTER_CELLS];
+    int head = 0;
+    int tail = 0;
+    memset(distances, 0xff, sizeof(unsigned short) * PATH_CLUSTER_CELLS);
+    distances[start] = 0;
+    queue[tail++] = start;
+    while (head < tail) {
+        int local = queue[head++];
+        GridPosition from = {local % PATH_CLUSTER_SIZE, local / PATH_CLUSTER_SIZE};
+        for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+            GridPosition next = get_position_in_direction(from, direction, 1);
+            if (next.x < 0 || next.x >= cluster->width || next.y < 0 || next.y >= cluster->height) {
+                continue;
+            }
+            int next_local = (next.y * PATH_CLUSTER_SIZE) + next.x;
+            if (distances[next_local] != PATH_UNREACHABLE || !is_path_cell_open(paths, cells, cluster->x + next.x, cluster->y + next.y)) {
+                continue;
+            }
+            distances[next_local] = distances[local] + 1;
+            queue[tail++] = next_local;
+        }
+    }
+}
+
+// one entrance in the middle of every run of cells that are open on both sides of the border
+static void add_path_side_entrances(PathHierarchy *paths, const unsigned char *cells, PathCluster *cluster, int side) {
+    int direction = side + DIRECTION_RIGHT;
+    bool along_y = (direction == DIRECTION_RIGHT || direction == DIRECTION_LEFT);
+    int length = along_y ? cluster->height : cluster->width;
+    GridPosition first = {
+        (direction == DIRECTION_RIGHT) ? (cluster->x + cluster->width - 1) : cluster->x,
+        (direction == DIRECTION_DOWN) ? (cluster->y + cluster->height - 1) : cluster->y,
+    };
+
+    int entrance_count = 0;
+    int run_start = -1;
+    for (int i = 0; i <= length; i++) {
+        bool open = false;
+        if (i < length) {
+            GridPosition cell = along_y ? (GridPosition) {first.x, first.y + i} : (GridPosition) {first.x + i, first.y};
+            GridPosition across = get_position_in_direction(cell, direction, 1);
+            across.x = (across.x + paths->width) % paths->width;
+            across.y = (across.y + paths->height) % paths->height;
+            open = is_path_cell_open(paths, cells, cell.x, cell.y) && is_path_cell_open(paths, cells, across.x, across.y);
+        }
+        if (open && run_start < 0) {
+            run_start = i;
+        } else if (!open && run_start >= 0) {
+            ASSERT(entrance_count < PATH_SIDE_ENTRANCES);
+            int middle = (run_start + i - 1) / 2;
+            GridPosition entrance = along_y ? (GridPosition) {first.x, first.y + middle} : (GridPosition) {first.x + middle, first.y};
+            int slot = (side * PATH_SIDE_ENTRANCES) + entrance_count++;
+            cluster->entrance_cells[slot] = ((entrance.y - cluster->y) * PATH_CLUSTER_SIZE) + (entrance.x - cluster->x);
+            cluster->columns[slot] = cluster->entrance_count;
+            cluster->slots[cluster->entrance_count++] = slot;
+            run_start = -1;
+        }
+    }
+}
+
+static bool build_path_cluster(PathHierarchy *paths, const unsigned char *cells, int idx) {
+    PathCluster *cluster = &paths->clusters[idx];
+    cluster->entrance_count = 0;
+    memset(cluster->columns, -1, sizeof(cluster->columns));
+    for (int side = 0; side < 4; side++) {
+        add_path_side_entrances(paths, cells, cluster, side);
+    }
+
+    cluster->distances = malloc(sizeof(unsigned short) * PATH_CLUSTER_CELLS * (cluster->entrance_count ? cluster->entrance_count : 1));
+    if (cluster->distances == NULL) {
+        return false;
+    }
+
+    unsigned short distances[PATH_CLUSTER_CELLS];
+    for (int column = 0; column < cluster->entrance_count; column++) {
+        get_path_cluster_distances(paths, cells, cluster, cluster->entrance_cells[cluster->slots[column]], distances);
+        for (int local = 0; local < PATH_CLUSTER_CELLS; local++) {
+            cluster->distances[(local * cluster->entrance_count) + column] = distances[local];
+        }
+    }
+    return true;
+}
+
+bool path_hierarchy_build(PathHierarchy *paths, const unsigned char *cells, int width, int height, int tiles_x) {
+    *paths = (PathHierarchy) {
+        .width = width,
+        .height = height,
+        .tiles_x = tiles_x,
+        .clusters_x = (width + PATH_CLUSTER_SIZE - 1) / PATH_CLUSTER_SIZE,
+        .clusters_y = (height + PATH_CLUSTER_SIZE - 1) / PATH_CLUSTER_SIZE,
+    };
+    paths->clusters = calloc(paths->clusters_x * paths->clusters_y, sizeof(PathCluster));
+    if (paths->clusters == NULL) {
+        return false;
+    }
+    for (int i = 0; i < paths->clusters_x * paths->clusters_y; i++) {
+        PathCluster *cluster = &paths->clusters[i];
+        cluster->x = (i % paths->clusters_x) * PATH_CLUSTER_SIZE;
+        cluster->y = (i / paths->clusters_x) * PATH_CLUSTER_SIZE;
+        cluster->width = (width - cluster->x < PATH_CLUSTER_SIZE) ? (width - cluster->x) : PATH_CLUSTER_SIZE;
+        cluster->height = (height - cluster->y < PATH_CLUSTER_SIZE) ? (height - cluster->y) : PATH_CLUSTER_SIZE;
+        if (!build_path_cluster(paths, cells, i)) {
+            path_hierarchy_free(paths);
+            return false;
+        }
+    }
+    paths->built = true;
+    return true;
+}
+
+static bool push_path_heap(PathField *field, int distance, int node) {
+    if (field->heap_count == field->heap_capacity) {
+        int capacity = field->heap_capacity ? field->heap_capacity * 2 : 256;
+        PathHeapEntry *heap = realloc(field->heap, sizeof(PathHeapEntry) * capacity);
+        if (heap == NULL) {
+            return false;
+        }
+        field->heap = heap;
+        field->heap_capacity = capacity;
+    }
+
+    int i = field->heap_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (field->heap[parent].distance <= distance) {
+            break;
+        }
+        field->heap[i] = field->heap[parent];
+        i = parent;
+    }
+    field->heap[i] = (PathHeapEntry) { distance, node };
+    return true;
+}
+
+static PathHeapEntry pop_path_heap(PathField *field) {
+    PathHeapEntry top = field->heap[0];
+    PathHeapEntry last = field->heap[--field->heap_count];
+    int i = 0;
+    for (;;) {
+        int child = (i * 2) + 1;
+        if (child >= field->heap_count) {
+            break;
+        }
+        if (child + 1 < field->heap_count && field->heap[child + 1].distance < field->heap[child].distance) {
+            child++;
+        }
+        if (last.distance <= field->heap[child].distance) {
+            break;
+        }
+        field->heap[i] = field->heap[child];
+        i = child;
+    }
+    if (field->heap_count > 0) {
+        field->heap[i] = last;
+    }
+    return top;
+}
+
+static void relax_path_node(PathField *field, int node, int distance) {
+    if (field->settled[node] == field->stamp) {
+        return;
+    }
+    if (field->seen[node] == field->stamp && field->distances[node] <= distance) {
+        return;
+    }
+    // a lost entry only makes the distance longer than it could be, never wrong to use
+    if (push_path_heap(field, distance, node)) {
+        field->seen[node] = field->stamp;
+        field->distances[node] = distance;
+    }
+}
+
+// resumes the search towards the target until every entrance of the cluster has its final distance
+static void settle_path_cluster(PathHierarchy *paths, PathField *field, int idx) {
+    const PathCluster *cluster = &paths->clusters[idx];
+    int column = 0;
+    while (column < cluster->entrance_count) {
+        if (field->settled[(idx * PATH_CLUSTER_ENTRANCES) + cluster->slots[column]] == field->stamp) {
+            column++;
+            continue;
+        }
+        if (field->heap_count == 0) {
+            break; // the rest can not reach the target
+        }
+
+        PathHeapEntry entry = pop_path_heap(field);
+        if (field->settled[entry.node] == field->stamp) {
+            continue;
+        }
+        field->settled[entry.node] = field->stamp;
+
+        int from_idx = entry.node / PATH_CLUSTER_ENTRANCES;
+        int slot = entry.node % PATH_CLUSTER_ENTRANCES;
+        int side = slot / PATH_SIDE_ENTRANCES;
+        const PathCluster *from = &paths->clusters[from_idx];
+
+        int cost;
+        int across_idx = get_path_neighbor_cluster(paths, from_idx, side, &cost);
+        int across_slot = (((side + 2) % 4) * PATH_SIDE_ENTRANCES) + (slot % PATH_SIDE_ENTRANCES);
+        if (paths->clusters[across_idx].columns[across_slot] >= 0) {
+            relax_path_node(field, (across_idx * PATH_CLUSTER_ENTRANCES) + across_slot, entry.distance + cost);
+        }
+
+        int from_column = from->columns[slot];
+        for (int i = 0; i < from->entrance_count; i++) {
+            int to_slot = from->slots[i];
+            int distance = from->distances[(from->entrance_cells[to_slot] * from->entrance_count) + from_column];
+            if (distance != PATH_UNREACHABLE) {
+                relax_path_node(field, (from_idx * PATH_CLUSTER_ENTRANCES) + to_slot, entry.distance + distance);
+            }
+        }
+    }
+}
+
+// fields are kept per target so ghosts chasing the same cell, or the same ghost deciding again, do not search again
+static PathField *get_path_field(PathHierarchy *paths, const unsigned char *cells, GridPosition target) {
+    paths->clock++;
+    PathField *field = &paths->fields[0];
+    for (int i = 0; i < PATH_FIELDS_MAX; i++) {
+        PathField *candidate = &paths->fields[i];
+        if (candidate->valid && grid_position_eq(candidate->target, target)) {
+            candidate->used = paths->clock;
+            return candidate;
+        }
+        if (!candidate->valid || (field->valid && candidate->used < field->used)) {
+            field = candidate;
+        }
+    }
+
+    if (field->distances == NULL) {
+        size_t node_count = (size_t)paths->clusters_x * paths->clusters_y * PATH_CLUSTER_ENTRANCES;
+        field->distances = malloc(sizeof(int) * node_count);
+        field->seen = calloc(node_count, sizeof(unsigned int));
+        field->settled = calloc(node_count, sizeof(unsigned int));
+        if (field->distances == NULL || field->seen == NULL || field->settled == NULL) {
+            free(field->distances);
+            free(field->seen);
+            free(field->settled);
+            field->distances = NULL;
+            field->seen = NULL;
+            field->settled = NULL;
+            return NULL;
+        }
+    }
+
+    paths->stamp++;
+    field->target = target;
+    field->valid = true;
+    field->used = paths->clock;
+    field->stamp = paths->stamp;
+    field->heap_count = 0;
+    field->cluster = get_path_cluster_index(paths, target.x, target.y);
+
+    const PathCluster *cluster = &paths->clusters[field->cluster];
+    int target_local = ((target.y - cluster->y) * PATH_CLUSTER_SIZE) + (target.x - cluster->x);
+    get_path_cluster_distances(paths, cells, cluster, target_local, field->local);
+    for (int i = 0; i < cluster->entrance_count; i++) {
+        int distance = cluster->distances[(target_local * cluster->entrance_count) + i];
+        if (distance != PATH_UNREACHABLE) {
+            relax_path_node(field, (field->cluster * PATH_CLUSTER_ENTRANCES) + cluster->slots[i], distance);
+        }
+    }
+    return field;
+}
+
+// steps from the position to the target of the field, PATH_DISTANCE_MAX if there is no way
+static int get_path_distance(PathHierarchy *paths, PathField *field, GridPosition position) {
+    int idx = get_path_cluster_index(paths, position.x, position.y);
+    const PathCluster *cluster = &paths->clusters[idx];
+    int local = ((position.y - cluster->y) * PATH_CLUSTER_SIZE) + (position.x - cluster->x);
+
+    int best = PATH_DISTANCE_MAX;
+    if (idx == field->cluster && field->local[local] != PATH_UNREACHABLE) {
+        best = field->local[local];
+    }
+
+    settle_path_cluster(paths, field, idx);
+    const unsigned short *row = &cluster->distances[local * cluster->entrance_count];
+    for (int i = 0; i < cluster->entrance_count; i++) {
+        int node = (idx * PATH_CLUSTER_ENTRANCES) + cluster->slots[i];
+        if (row[i] != PATH_UNREACHABLE && field->settled[node] == field->stamp && row[i] + field->distances[node] < best) {
+            best = row[i] + field->distances[node];
+        }
+    }
+    return best;
+}
+
+// -1 for positions further out than the tunnels
+static inline int get_path_flow_node(const PathHierarchy *paths, GridPosition position) {
+    int cell_count = paths->width * paths->height;
+    bool x_inside = position.x >= 0 && position.x < paths->width;
+    bool y_inside = position.y >= 0 && position.y < paths->height;
+    if (x_inside && y_inside) {
+        return (position.y * paths->width) + position.x;
+    }
+    if (y_inside && (position.x == -1 || position.x == paths->width)) {
+        return cell_count + position.y;
+    }
+    if (x_inside && (position.y == -1 || position.y == paths->height)) {
+        return cell_count + paths->height + position.x;
+    }
+    return -1;
+}
+
+static inline void visit_path_flow_node(PathHierarchy *paths, const unsigned char *cells, GridPosition position, int distance) {
+    PathFlow *flow = &paths->flow;
+    bool out_of_bounds = position.x < 0 || position.x >= paths->width || position.y < 0 || position.y >= paths->height;
+    if (!out_of_bounds && !is_path_cell_open(paths, cells, position.x, position.y)) {
+        return;
+    }
+    int node = get_path_flow_node(paths, position);
+    if (flow->seen[node] != flow->stamp) {
+        flow->seen[node] = flow->stamp;
+        flow->distances[node] = distance;
+        flow->queue[flow->tail++] = node;
+    }
+}
+
+// starts over only when the target moved to another cell, otherwise every ghost continues where the last one stopped
+static PathFlow *get_path_flow(PathHierarchy *paths, const unsigned char *cells, GridPosition target) {
+    PathFlow *flow = &paths->flow;
+    if (flow->valid && grid_position_eq(flow->target, target)) {
+        return flow;
+    }
+
+    if (flow->distances == NULL) {
+        size_t node_count = ((size_t)paths->width * paths->height) + paths->height + paths->width;
+        flow->distances = malloc(sizeof(int) * node_count);
+        flow->seen = calloc(node_count, sizeof(unsigned int));
+        flow->queue = malloc(sizeof(int) * node_count);
+        if (flow->distances == NULL || flow->seen == NULL || flow->queue == NULL) {
+            free(flow->distances);
+            free(flow->seen);
+            free(flow->queue);
+            flow->distances = NULL;
+            flow->seen = NULL;
+            flow->queue = NULL;
+            return NULL;
+        }
+    }
+
+    flow->target = target;
+    flow->valid = true;
+    flow->stamp++;
+    flow->head = 0;
+    flow->tail = 0;
+    visit_path_flow_node(paths, cells, target, 0);
+    return flow;
+}
+
+// steps from the position to the target of the flow, -1 if there is no way
+static int get_path_flow_distance(PathHierarchy *paths, PathFlow *flow, const unsigned char *cells, GridPosition position) {
+    int node = get_path_flow_node(paths, position);
+    if (node < 0) {
+        return -1;
+    }
+
+    int cell_count = paths->width * paths->height;
+    while (flow->seen[node] != flow->stamp && flow->head < flow->tail) {
+        int from_node = flow->queue[flow->head++];
+        int distance = flow->distances[from_node] + 1;
+        if (from_node >= cell_count + paths->height) {
+            int x = from_node - cell_count - paths->height;
+            visit_path_flow_node(paths, cells, (GridPosition) {x, 0}, distance);
+            visit_path_flow_node(paths, cells, (GridPosition) {x, paths->height - 1}, distance);
+        } else if (from_node >= cell_count) {
+            int y = from_node - cell_count;
+            visit_path_flow_node(paths, cells, (GridPosition) {0, y}, distance);
+            visit_path_flow_node(paths, cells, (GridPosition) {paths->width - 1, y}, distance);
+        } else {
+            GridPosition from = {from_node % paths->width, from_node / paths->width};
+            for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+                visit_path_flow_node(paths, cells, get_position_in_direction(from, direction, 1), distance);
+            }
+        }
+    }
+    return (flow->seen[node] == flow->stamp) ? flow->distances[node] : -1;
+}
+
+const LevelTemplate *get_level_template(Maze *maze) {
+    LevelTemplate *template = &maze->template;
+    if (template->built) {
+        return template;
+    }
+
+    int width = maze->header->width;
+    int height = maze->header->height;
+    template->tiles_x = get_grid_tile_count(width);
+    template->grid_size = get_grid_size(width, height);
+    template->dot_count = 0;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (maze->cells[get_tiled_index(template->tiles_x, x, y)] & (FLAG_DOT | FLAG_BIG_DOT)) {
+                template->dot_count++;
+            }
+        }
+    }
+    ASSERT(template->dot_count == maze->header->dot_count);
+
+    template->built = true;
+    return template;
+}
+
+// built on first use, NULL if it could not be allocated
+const MazeGraph *get_maze_graph(Maze *maze) {
+    MazeGraph *graph = &maze->graph;
+    if (graph->built) {
+        return graph;
+    }
+    const LevelTemplate *template = get_level_template(maze);
+    if (!maze_graph_build(graph, maze, template->tiles_x, template->grid_size)) {
+        TraceLog(LOG_WARNING, "LEVEL: Failed to allocate the maze graph");
+        return NULL;
+    }
+    return graph;
+}
+
+// built on first use since small mazes never need it, NULL if it could not be allocated
+PathHierarchy *get_path_hierarchy(Maze *maze) {
+    PathHierarchy *paths = &maze->paths;
+    if (paths->built) {
+        return paths;
+    }
+    const LevelTemplate *template = get_level_template(maze);
+    if (!path_hierarchy_build(paths, maze->cells, maze->header->width, maze->header->height, template->tiles_x)) {
+        TraceLog(LOG_WARNING, "LEVEL: Failed to allocate pathfinding, ghosts will use straight lines");
+        return NULL;
+    }
+    return paths;
+}
+
+static int compare_file_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// every level file in the directory becomes one maze, levels cycle through them in file name order
+int load_mazes(const char *directory) {
+    FilePathList files = LoadDirectoryFilesEx(directory, LEVEL_FILE_EXTENSION, false);
+    qsort(files.paths, files.count, sizeof(files.paths[0]), compare_file_names);
+
+    state->mazes = calloc(files.count, sizeof(Maze));
+    state->maze_count = 0;
+    for (unsigned int i = 0; i < files.count; i++) {
+        if (maze_load(&state->mazes[state->maze_count], files.paths[i])) {
+            state->maze_count++;
+        }
+    }
+
+    TraceLog(LOG_INFO, "LEVEL: Loaded %i of %u mazes from %s", state->maze_count, files.count, directory);
+    UnloadDirectoryFiles(files);
+    return state->maze_count;
+}
+
+void unload_mazes(void) {
+    for (int i = 0; i < state->maze_count; i++) {
+        maze_unload(&state->mazes[i]);
+    }
+    free(state->mazes);
+    state->mazes = NULL;
+    state->maze_count = 0;
+}
+
+bool record_heatmaps = false;
+
+// visits are counted when an actor enters a cell, the layers are row major width * height each
+bool heatmap_alloc(Maze *maze) {
+    Heatmap *heatmap = &maze->heatmap;
+    if (heatmap->visits != NULL) {
+        return true;
+    }
+    heatmap->width = maze->header->width;
+    heatmap->height = maze->header->height;
+    heatmap->visits = calloc((size_t)heatmap->width * heatmap->height * HEATMAP_ACTOR_COUNT, sizeof(unsigned int));
+    return heatmap->visits != NULL;
+}
+
+static inline unsigned int *get_heatmap_layer(const Heatmap *heatmap, int actor) {
+    return &heatmap->visits[(size_t)actor * heatmap->width * heatmap->height];
+}
+
+void heatmap_clear(Heatmap *heatmap) {
+    if (heatmap->visits == NULL) {
+        return;
+    }
+    memset(heatmap->visits, 0, (size_t)heatmap->width * heatmap->height * HEATMAP_ACTOR_COUNT * sizeof(unsigned int));
+    memset(heatmap->max, 0, sizeof(heatmap->max));
+}
+
+// simulation thread is the only writer, the renderer reads the same cells for the overlay
+void record_visit(int actor, GridPosition position) {
+    Heatmap *heatmap = state->heatmap;
+    if (heatmap == NULL || is_out_of_bounds(position)) {
+        return;
+    }
+    unsigned int *count = &get_heatmap_layer(heatmap, actor)[(position.y * heatmap->width) + position.x];
+    unsigned int value = __atomic_load_n(count, __ATOMIC_RELAXED) + 1;
+    __atomic_store_n(count, value, __ATOMIC_RELAXED);
+    if (value > __atomic_load_n(&heatmap->max[actor], __ATOMIC_RELAXED)) {
+        __atomic_store_n(&heatmap->max[actor], value, __ATOMIC_RELAXED);
+    }
+}
+
+static void heatmap_add(Heatmap *heatmap, const unsigned int *visits) {
+    size_t cells = (size_t)heatmap->width * heatmap->height;
+    for (int actor = 0; actor < HEATMAP_ACTOR_COUNT; actor++) {
+        unsigned int *layer = get_heatmap_layer(heatmap, actor);
+        const unsigned int *add = &visits[(size_t)actor * cells];
+        for (size_t i = 0; i < cells; i++) {
+            layer[i] += add[i];
+            if (layer[i] > heatmap->max[actor]) {
+                heatmap->max[actor] = layer[i];
+            }
+        }
+    }
+}
+
+// adds the counts of every maze in the file that matches a loaded maze, so runs accumulate
+bool load_heatmaps(const char *file_name) {
+    if (!FileExists(file_name)) {
+        return false;
+    }
+    int size = 0;
+    unsigned char *data = LoadFileData(file_name, &size);
+    if (data == NULL) {
+        return false;
+    }
+
+    bool valid = false;
+    const HeatmapFileHeader *header = (const HeatmapFileHeader *)data;
+    if (size >= (int)sizeof(HeatmapFileHeader) && header->magic == HEATMAP_FILE_MAGIC && header->version == HEATMAP_FILE_VERSION) {
+        valid = true;
+        size_t offset = sizeof(HeatmapFileHeader);
+        for (int i = 0; i < header->maze_count; i++) {
+            if (offset + sizeof(HeatmapFileMaze) > (size_t)size) {
+                valid = false;
+                break;
+            }
+            const HeatmapFileMaze *entry = (const HeatmapFileMaze *)(data + offset);
+            offset += sizeof(HeatmapFileMaze);
+            size_t bytes = (size_t)entry->width * entry->height * HEATMAP_ACTOR_COUNT * sizeof(unsigned int);
+            if (entry->width > GRID_SIZE_MAX || entry->height > GRID_SIZE_MAX || offset + bytes > (size_t)size) {
+                valid = false;
+                break;
+            }
+            for (int j = 0; j < state->maze_count; j++) {
+                Maze *maze = &state->mazes[j];
+                const LevelHeader *level = maze->header;
+                if (level->checksum == entry->checksum && level->width == entry->width && level->height == entry->height) {
+                    if (heatmap_alloc(maze)) {
+                        heatmap_add(&maze->heatmap, (const unsigned int *)(data + offset));
+                    }
+                    break;
+                }
+            }
+            offset += bytes;
+        }
+    }
+    UnloadFileData(data);
+
+    if (!valid) {
+        TraceLog(LOG_WARNING, "HEATMAP: [%s] Not a valid heatmap file", file_name);
+    }
+    return valid;
+}
+
+bool save_heatmaps(const char *file_name) {
+    size_t size = sizeof(HeatmapFileHeader);
+    int maze_count = 0;
+    for (int i = 0; i < state->maze_count; i++) {
+        const Heatmap *heatmap = &state->mazes[i].heatmap;
+        if (heatmap->visits != NULL) {
+            size += sizeof(HeatmapFileMaze) + ((size_t)heatmap->width * heatmap->height * HEATMAP_ACTOR_COUNT * sizeof(unsigned int));
+            maze_count++;
+        }
+    }
+
+    unsigned char *data = malloc(size);
+    if (data == NULL) {
+        return false;
+    }
+    *(HeatmapFileHeader *)data = (HeatmapFileHeader) {
+        .magic = HEATMAP_FILE_MAGIC,
+        .version = HEATMAP_FILE_VERSION,
+        .maze_count = maze_count,
+    };
+    size_t offset = sizeof(HeatmapFileHeader);
+    for (int i = 0; i < state->maze_count; i++) {
+        const Maze *maze = &state->mazes[i];
+        const Heatmap *heatmap = &maze->heatmap;
+        if (heatmap->visits == NULL) {
+            continue;
+        }
+        *(HeatmapFileMaze *)(data + offset) = (HeatmapFileMaze) {
+            .checksum = maze->header->checksum,
+            .width = heatmap->width,
+            .height = heatmap->height,
+        };
+        offset += sizeof(HeatmapFileMaze);
+        size_t bytes = (size_t)heatmap->width * heatmap->height * HEATMAP_ACTOR_COUNT * sizeof(unsigned int);
+        memcpy(data + offset, heatmap->visits, bytes);
+        offset += bytes;
+    }
+
+    bool saved = SaveFileData(file_name, data, (int)size);
+    free(data);
+    return saved;
+}
+
+// render thread only, -1 hides the overlay
+int heatmap_overlay = -1;
+
+void cycle_heatmap_overlay(void) {
+    heatmap_overlay++;
+    if (heatmap_overlay >= HEATMAP_ACTOR_COUNT) {
+        heatmap_overlay = -1;
+    }
+}
+
+typedef struct {
+    int *parents;
+    int *ranks;
+} UnionFind;
+
+static int union_find_root(UnionFind *uf, int i) {
+    while (uf->parents[i] != i) {
+        uf->parents[i] = uf->parents[uf->parents[i]];
+        i = uf->parents[i];
+    }
+    return i;
+}
+
+static bool union_find_join(UnionFind *uf, int a, int b) {
+    a = union_find_root(uf, a);
+    b = union_find_root(uf, b);
+    if (a == b) {
+        return false;
+    }
+    if (uf->ranks[a] < uf->ranks[b]) {
+        int t = a; a = b; b = t;
+    }
+    uf->parents[b] = a;
+    if (uf->ranks[a] == uf->ranks[b]) {
+        uf->ranks[a]++;
+    }
+    return true;
+}
+
+static void union_find_reset(UnionFind *uf, int count) {
+    for (int i = 0; i < count; i++) {
+        uf->parents[i] = i;
+        uf->ranks[i] = 0;
+    }
+}
+
+typedef struct {
+    GridPosition a;
+    GridPosition b;
+    bool forced;
+} GeneratorEdge;
+
+// scratch memory for one generator thread, sized for one maze so nothing is allocated per maze
+typedef struct {
+    int width;
+    int height;
+    LevelHeader *header;
+    size_t size;
+    UnionFind uf;
+    GeneratorEdge *edges;
+    int edge_count;
+} Generator;
+
+static inline unsigned char *generator_cell(Generator *gen, int x, int y) {
+    return &get_maze_cells(gen->header)[get_tiled_index(get_grid_tile_count(gen->width), x, y)];
+}
+
+static inline bool generator_is_open(Generator *gen, int x, int y) {
+    if (x < 0 || y < 0 || x >= gen->width || y >= gen->height) {
+        return true; // tunnels lead out of bounds and wrap_teleport brings them back
+    }
+    return !(*generator_cell(gen, x, y) & FLAG_WALL);
+}
+
+// carves the left half, the right half is mirrored in later
+static inline void generator_carve(Generator *gen, int x, int y) {
+    *generator_cell(gen, x, y) = FLAG_NONE;
+}
+
+static void generator_carve_edge(Generator *gen, GeneratorEdge *edge) {
+    generator_carve(gen, edge->a.x, edge->a.y);
+    generator_carve(gen, (edge->a.x + edge->b.x) / 2, (edge->a.y + edge->b.y) / 2);
+    generator_carve(gen, edge->b.x, edge->b.y);
+}
+
+bool generator_init(Generator *gen, int width, int height) {
+    // the lattice of corridors sits on odd cells and the middle column has to be one of them
+    *gen = (Generator) {0};
+    if (width < 11 || height < 11 || (width % 4) != 3) {
+        TraceLog(LOG_WARNING, "GENERATOR: Cannot generate %ix%i mazes, width must be 4n+3 and both sides at least 11", width, height);
+        return false;
+    }
+
+    int cell_count = width * height;
+    *gen = (Generator) {
+        .width = width,
+        .height = height,
+        .size = get_maze_size(width, height),
+    };
+    gen->header = malloc(gen->size);
+    gen->uf.parents = malloc(sizeof(int) * cell_count);
+    gen->uf.ranks = malloc(sizeof(int) * cell_count);
+    gen->edges = malloc(sizeof(GeneratorEdge) * cell_count);
+
+    return gen->header && gen->uf.parents && gen->uf.ranks && gen->edges;
+}
+
+void generator_free(Generator *gen) {
+    free(gen->header);
+    free(gen->uf.parents);
+    free(gen->uf.ranks);
+    free(gen->edges);
+}
+
+// union-find over every open cell, the maze is only usable if all of it is one region,
+// nothing is a dead end (ghosts can not turn around) and the ghost house door leads into it
+static bool generator_validate(Generator *gen) {
+    LevelHeader *header = gen->header;
+    int width = gen->width;
+    int height = gen->height;
+
+    union_find_reset(&gen->uf, width * height);
+
+    GridPosition interior_min = { header->ghost_house_center.x - 2, header->ghost_house_center.y };
+    GridPosition interior_max = { header->ghost_house_center.x + 2, header->ghost_house_center.y };
+
+    for (int x = 0; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+            if (!generator_is_open(gen, x, y)) {
+                continue;
+            }
+
+            bool interior = y == interior_min.y && x >= interior_min.x && x <= interior_max.x;
+            if (interior) {
+                continue;
+            }
+
+            int exits = 0;
+            for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+                GridPosition n = get_position_in_direction((GridPosition){x,y}, direction, 1);
+                if (generator_is_open(gen, n.x, n.y)) {
+                    exits++;
+                }
+            }
+            if (exits < 2) {
+                return false;
+            }
+
+            if (x + 1 < width && generator_is_open(gen, x + 1, y)) {
+                union_find_join(&gen->uf, (x * height) + y, ((x + 1) * height) + y);
+            }
+            if (y + 1 < height && generator_is_open(gen, x, y + 1)) {
+                union_find_join(&gen->uf, (x * height) + y, (x * height) + y + 1);
+            }
+            if (x == 0 && generator_is_open(gen, width - 1, y)) {
+                union_find_join(&gen->uf, y, ((width - 1) * height) + y);
+            }
+        }
+    }
+
+    for (int x = 0; x < width; x++) {
+        if (generator_is_open(gen, x, 0) || generator_is_open(gen, x, height - 1)) {
+            return false; // wrap_teleport also wraps vertically but only side tunnels are generated
+        }
+    }
+
+    int root = union_find_root(&gen->uf, (header->player_start.x * height) + header->player_start.y);
+    for (int x = 0; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+            bool interior = y == interior_min.y && x >= interior_min.x && x <= interior_max.x;
+            if (interior || !generator_is_open(gen, x, y)) {
+                continue;
+            }
+            if (union_find_root(&gen->uf, (x * height) + y) != root) {
+                return false;
+            }
+        }
+    }
+
+    GridPosition door = header->ghost_house_door;
+    GridPosition outside = header->outside_ghost_house_door;
+    return
+        !generator_is_open(gen, door.x, door.y) &&
+        generator_is_open(gen, outside.x, outside.y) &&
+        union_find_root(&gen->uf, (outside.x * height) + outside.y) == root;
+}
+
+static bool generator_attempt(Generator *gen, Rng *rng) {
+    LevelHeader *header = gen->header;
+    int width = gen->width;
+    int height = gen->height;
+    int cx = width / 2;
+    int y_max = ((height - 2) % 2) ? (height - 2) : (height - 3);
+
+    // ghost house: a ring corridor around walls with a five cell room, the door is the wall above the middle
+    int y0 = ((height / 2) - 2) | 1;
+    int ring_left = cx - 4;
+
+    memset(header, 0, sizeof(LevelHeader));
+    header->width = width;
+    header->height = height;
+    header->outside_ghost_house_door = (GridPosition){cx, y0};
+    header->ghost_house_door = (GridPosition){cx, y0 + 1};
+    header->ghost_house_center = (GridPosition){cx, y0 + 2};
+    header->ghost_house_left_side = (GridPosition){cx - 1, y0 + 2};
+    header->ghost_house_right_side = (GridPosition){cx + 1, y0 + 2};
+    header->player_start = (GridPosition){cx, (y0 + 6 <= y_max) ? (y0 + 6) : (y0 - 2)};
+
+    memset(get_maze_cells(header), FLAG_WALL, get_grid_size(width, height));
+
+    #define IS_HOUSE_INTERIOR_NODE(x, y) ((y) == y0 + 2 && (x) > ring_left)
+    #define IS_HOUSE_RING_NODE(x, y) \
+        (((y) == y0 || (y) == y0 + 4) && (x) >= ring_left) || \
+        ((x) == ring_left && (y) >= y0 && (y) <= y0 + 4)
+
+    gen->edge_count = 0;
+    for (int x = 1; x <= cx; x += 2) {
+        for (int y = 1; y <= y_max; y += 2) {
+            if (IS_HOUSE_INTERIOR_NODE(x, y)) {
+                continue;
+            }
+            GridPosition a = { x, y };
+            GridPosition neighbors[2] = { { x + 2, y }, { x, y + 2 } };
+            for (int i = 0; i < 2; i++) {
+                GridPosition b = neighbors[i];
+                if (b.x > cx || b.y > y_max || IS_HOUSE_INTERIOR_NODE(b.x, b.y)) {
+                    continue;
+                }
+                gen->edges[gen->edge_count++] = (GeneratorEdge) {
+                    .a = a,
+                    .b = b,
+                    .forced = (IS_HOUSE_RING_NODE(a.x, a.y)) && (IS_HOUSE_RING_NODE(b.x, b.y)),
+                };
+            }
+        }
+    }
+
+    #undef IS_HOUSE_INTERIOR_NODE
+    #undef IS_HOUSE_RING_NODE
+
+    // randomized kruskal over the left half lattice, the ring around the ghost house always exists
+    for (int i = gen->edge_count - 1; i > 0; i--) {
+        int j = rng_range(rng, i + 1);
+        GeneratorEdge t = gen->edges[i];
+        gen->edges[i] = gen->edges[j];
+        gen->edges[j] = t;
+    }
+
+    union_find_reset(&gen->uf, width * height);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < gen->edge_count; i++) {
+            GeneratorEdge *edge = &gen->edges[i];
+            if ((pass == 0) != edge->forced) {
+                continue;
+            }
+            int a = (edge->a.x * height) + edge->a.y;
+            int b = (edge->b.x * height) + edge->b.y;
+            bool joined = union_find_join(&gen->uf, a, b);
+            if (joined || edge->forced || rng_range(rng, 100) < GENERATOR_EXTRA_EDGE_PERCENT) {
+                generator_carve_edge(gen, edge);
+            }
+        }
+    }
+
+    // braid: a tree is full of dead ends, open one more edge from every lattice node that has a single exit
+    for (int i = 0; i < gen->edge_count; i++) {
+        GeneratorEdge *edge = &gen->edges[i];
+        GridPosition ends[2] = { edge->a, edge->b };
+        for (int e = 0; e < 2; e++) {
+            GridPosition n = ends[e];
+            int exits = 0;
+            for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+                GridPosition p = get_position_in_direction(n, direction, 1);
+                if (p.x > cx) {
+                    p.x = width - 1 - p.x;
+                }
+                if (generator_is_open(gen, p.x, p.y)) {
+                    exits++;
+                }
+            }
+            if (exits < 2) {
+                generator_carve_edge(gen, edge);
+            }
+        }
+    }
+
+    // tunnel on a random lattice row, away from the corners
+    int tunnel_rows = (y_max - 1) / 2 - 1;
+    int tunnel_y = 3 + (2 * rng_range(rng, tunnel_rows > 0 ? tunnel_rows : 1));
+    generator_carve(gen, 0, tunnel_y);
+
+    for (int x = cx + 1; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+            *generator_cell(gen, x, y) = *generator_cell(gen, width - 1 - x, y);
+        }
+    }
+
+    for (int x = cx - 2; x <= cx + 2; x++) {
+        generator_carve(gen, x, y0 + 2);
+    }
+
+    for (int x = 1; x < width - 1; x++) {
+        for (int y = 1; y < height - 1; y++) {
+            bool in_house = x >= ring_left && x <= width - 1 - ring_left && y >= y0 && y <= y0 + 4;
+            if (in_house || grid_position_eq((GridPosition){x,y}, header->player_start)) {
+                continue;
+            }
+            if (generator_is_open(gen, x, y)) {
+                *generator_cell(gen, x, y) = FLAG_DOT;
+            }
+        }
+    }
+    *generator_cell(gen, 1, 3) = FLAG_BIG_DOT;
+    *generator_cell(gen, width - 2, 3) = FLAG_BIG_DOT;
+    *generator_cell(gen, 1, y_max - 2) = FLAG_BIG_DOT;
+    *generator_cell(gen, width - 2, y_max - 2) = FLAG_BIG_DOT;
+
+    if (!generator_validate(gen)) {
+        return false;
+    }
+
+    maze_finalize(header);
+    return true;
+}
+
+// same seed always gives the same maze, no matter which thread or in what order it was generated
+bool generator_run(Generator *gen, unsigned long long seed) {
+    Rng rng = { seed };
+    for (int attempt = 0; attempt < GENERATOR_ATTEMPTS_MAX; attempt++) {
+        if (generator_attempt(gen, &rng)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    const char *directory;
+    unsigned long long seed;
+    int width;
+    int height;
+    int count;
+    int next;
+    int generated;
+    int failed;
+} GeneratorBatch;
+
+static unsigned long long get_batch_maze_seed(unsigned long long seed, int idx) {
+    Rng rng = { seed ^ ((unsigned long long)idx * 0xd1b54a32d192ed03ULL) };
+    return rng_next(&rng);
+}
+
+static void *generator_thread(void *arg) {
+    GeneratorBatch *batch = arg;
+    Generator gen;
+
+    if (generator_init(&gen, batch->width, batch->height)) {
+        while (true) {
+            int idx = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+            if (idx >= batch->count) {
+                break;
+            }
+
+            Maze maze = {
+                .header = gen.header,
+                .memory = gen.header,
+                .size = gen.size,
+            };
+            // TextFormat() shares its buffers between threads
+            char file_name[1024];
+            snprintf(file_name, sizeof(file_name), "%s/maze_%06i%s", batch->directory, idx, LEVEL_FILE_EXTENSION);
+
+            bool ok = generator_run(&gen, get_batch_maze_seed(batch->seed, idx)) && maze_save(&maze, file_name);
+            __atomic_fetch_add(ok ? &batch->generated : &batch->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    generator_free(&gen);
+    return NULL;
+}
+
+static int get_default_thread_count(void) {
+#if defined(_WIN32)
+    return 4;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+int generate_mazes(const char *directory, int count, unsigned long long seed, int width, int height, int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = get_default_thread_count();
+    }
+    if (thread_count > GENERATOR_THREADS_MAX) {
+        thread_count = GENERATOR_THREADS_MAX;
+    }
+
+    if (!DirectoryExists(directory) && MakeDirectory(directory) != 0) {
+        TraceLog(LOG_WARNING, "GENERATOR: Failed to create %s", directory);
+        return 0;
+    }
+
+    GeneratorBatch batch = {
+        .directory = directory,
+        .seed = seed,
+        .width = width,
+        .height = height,
+        .count = count,
+    };
+
+    // raylib logs every saved file
+    SetTraceLogLevel(LOG_WARNING);
+
+    double start = get_wall_time();
+    pthread_t threads[GENERATOR_THREADS_MAX];
+    int started = 0;
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&threads[started], NULL, generator_thread, &batch) != 0) {
+            TraceLog(LOG_WARNING, "GENERATOR: Failed to start thread, continuing with %i", started);
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        // generate on this thread instead
+        generator_thread(&batch);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    thread_count = started ? started : 1;
+    double seconds = get_wall_time() - start;
+
+    SetTraceLogLevel(LOG_INFO);
+    TraceLog(
+        LOG_INFO,
+        "GENERATOR: %i mazes in %.3fs (%.0f/s) on %i threads, %i failed",
+        batch.generated, seconds, batch.generated / (seconds > 0 ? seconds : 1), thread_count, batch.failed
+    );
+
+    return batch.generated;
+}
+
+enum {
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_CACHE_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_COUNT,
+};
+
+enum {
+    PERF_SECTION_UPDATE,
+    PERF_SECTION_RENDER_GRID,
+    PERF_SECTION_END_DRAWING,
+    PERF_SECTION_COUNT,
+};
+
+static const char *perf_section_names[PERF_SECTION_COUNT] = {
+    [PERF_SECTION_UPDATE] = "update",
+    [PERF_SECTION_RENDER_GRID] = "render grid",
+    [PERF_SECTION_END_DRAWING] = "EndDrawing",
+};
+
+// one counter group per thread, the kernel only counts the thread that opened it
+typedef struct {
+    bool opened;
+    int group_fd; // the leader, -1 if counting failed on this thread
+    int fds[PERF_COUNTER_COUNT];
+    int section; // open on this thread, -1 if none
+    unsigned long long start[PERF_COUNTER_COUNT];
+} PerfThread;
+
+// a section is started and ended on one thread, job workers add what they did for it to the same totals,
+// the totals are read by the render thread for the per frame rows
+typedef struct {
+    unsigned long long samples;
+    unsigned long long values[PERF_COUNTER_COUNT];
+} PerfSection;
+
+typedef struct {
+    bool enabled;
+    FILE *frames;
+    PerfSection sections[PERF_SECTION_COUNT];
+    PerfSection last_frame[PERF_SECTION_COUNT];
+    int group_fds[PERF_THREADS_MAX][PERF_COUNTER_COUNT]; // every counter of every thread, closed at shutdown
+    int group_count;
+} PerfCounters;
+
+PerfCounters perf_counters;
+__thread PerfThread perf_thread = { .section = -1 };
+
+#if defined(__linux__)
+static bool open_perf_thread(void) {
+    static const struct {
+        unsigned int type;
+        unsigned long long config;
+    } events[PERF_COUNTER_COUNT] = {
+        [PERF_COUNTER_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        [PERF_COUNTER_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        [PERF_COUNTER_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        [PERF_COUNTER_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    perf_thread.opened = true;
+    perf_thread.group_fd = -1;
+    int opened = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (i == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, perf_thread.group_fd, 0);
+        if (fd < 0) {
+            TraceLog(LOG_WARNING, "PERF: Failed to open hardware counter %i, check perf_event_paranoid", i);
+            break;
+        }
+        perf_thread.fds[opened++] = fd;
+        if (i == 0) {
+            perf_thread.group_fd = fd;
+        }
+    }
+
+    int slot = -1;
+    if (opened == PERF_COUNTER_COUNT) {
+        slot = __atomic_fetch_add(&perf_counters.group_count, 1, __ATOMIC_RELAXED);
+        if (slot >= PERF_THREADS_MAX) {
+            TraceLog(LOG_WARNING, "PERF: More than %i threads, not counting this one", PERF_THREADS_MAX);
+        }
+    }
+    if (slot < 0 || slot >= PERF_THREADS_MAX) {
+        for (int i = 0; i < opened; i++) {
+            close(perf_thread.fds[i]);
+        }
+        perf_thread.group_fd = -1;
+        return false;
+    }
+    memcpy(perf_counters.group_fds[slot], perf_thread.fds, sizeof(perf_thread.fds));
+    ioctl(perf_thread.group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_thread.group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+static bool read_perf_thread(unsigned long long *values) {
+    struct {
+        unsigned long long count;
+        unsigned long long values[PERF_COUNTER_COUNT];
+    } group;
+    if (read(perf_thread.group_fd, &group, sizeof(group)) != (ssize_t)sizeof(group) || group.count != PERF_COUNTER_COUNT) {
+        return false;
+    }
+    memcpy(values, group.values, sizeof(group.values));
+    return true;
+}
+#endif
+
+void perf_begin(int section) {
+#if defined(__linux__)
+    if (!perf_counters.enabled) {
+        return;
+    }
+    if (!perf_thread.opened) {
+        open_perf_thread();
+    }
+    if (perf_thread.group_fd >= 0 && read_perf_thread(perf_thread.start)) {
+        perf_thread.section = section;
+    }
+#else
+    (void)section;
+#endif
+}
+
+// workers end without a sample so the section still counts once per time it ran
+static void end_perf_section(bool sample) {
+#if defined(__linux__)
+    int section = perf_thread.section;
+    perf_thread.section = -1;
+    if (!perf_counters.enabled || section < 0) {
+        return;
+    }
+    unsigned long long values[PERF_COUNTER_COUNT];
+    if (!read_perf_thread(values)) {
+        return;
+    }
+    PerfSection *totals = &perf_counters.sections[section];
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        __atomic_fetch_add(&totals->values[i], values[i] - perf_thread.start[i], __ATOMIC_RELAXED);
+    }
+    if (sample) {
+        __atomic_fetch_add(&totals->samples, 1, __ATOMIC_RELAXED);
+    }
+#else
+    (void)sample;
+#endif
+}
+
+void perf_end(void) {
+    end_perf_section(true);
+}
+
+// the section the calling thread has open, for job workers helping with it
+static inline int get_perf_section(void) {
+    return perf_thread.section;
+}
+
+bool start_perf_counters(const char *file_name) {
+#if defined(__linux__)
+    perf_counters.frames = fopen(file_name, "w");
+    if (perf_counters.frames == NULL) {
+        TraceLog(LOG_ERROR, "PERF: [%s] Failed to open per frame counter file", file_name);
+        return false;
+    }
+    fprintf(perf_counters.frames, "frame,section,samples,cycles,instructions,cache_misses,branch_misses\n");
+    perf_counters.enabled = true;
+    return true;
+#else
+    (void)file_name;
+    TraceLog(LOG_WARNING, "PERF: Hardware counters are only supported on Linux");
+    return false;
+#endif
+}
+
+// render thread, once per frame, writes how much every section cost since the previous frame
+void write_perf_frame(unsigned long long frame) {
+    if (!perf_counters.enabled) {
+        return;
+    }
+    for (int section = 0; section < PERF_SECTION_COUNT; section++) {
+        PerfSection now;
+        now.samples = __atomic_load_n(&perf_counters.sections[section].samples, __ATOMIC_RELAXED);
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            now.values[i] = __atomic_load_n(&perf_counters.sections[section].values[i], __ATOMIC_RELAXED);
+        }
+        PerfSection *last = &perf_counters.last_frame[section];
+        if (now.samples != last->samples) {
+            fprintf(
+                perf_counters.frames, "%llu,%s,%llu,%llu,%llu,%llu,%llu\n",
+                frame, perf_section_names[section], now.samples - last->samples,
+                now.values[PERF_COUNTER_CYCLES] - last->values[PERF_COUNTER_CYCLES],
+                now.values[PERF_COUNTER_INSTRUCTIONS] - last->values[PERF_COUNTER_INSTRUCTIONS],
+                now.values[PERF_COUNTER_CACHE_MISSES] - last->values[PERF_COUNTER_CACHE_MISSES],
+                now.values[PERF_COUNTER_BRANCH_MISSES] - last->values[PERF_COUNTER_BRANCH_MISSES]
+            );
+        }
+        *last = now;
+    }
+}
+
+// call after the simulation stopped and while the job workers are idle
+void stop_perf_counters(void) {
+    if (!perf_counters.enabled) {
+        return;
+    }
+    perf_counters.enabled = false;
+    fclose(perf_counters.frames);
+    perf_counters.frames = NULL;
+#if defined(__linux__)
+    int group_count = min_int(perf_counters.group_count, PERF_THREADS_MAX);
+    for (int i = 0; i < group_count; i++) {
+        for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+            close(perf_counters.group_fds[i][j]);
+        }
+    }
+    perf_counters.group_count = 0;
+#endif
+
+    printf("\n%-12s %10s %16s %16s %6s %14s %14s\n", "section", "samples", "cycles", "instructions", "ipc", "cache misses", "branch misses");
+    for (int section = 0; section < PERF_SECTION_COUNT; section++) {
+        PerfSection *s = &perf_counters.sections[section];
+        if (s->samples == 0) {
+            continue;
+        }
+        unsigned long long *v = s->values;
+        printf(
+            "%-12s %10llu %16llu %16llu %6.2f %14llu %14llu\n",
+            perf_section_names[section], s->samples, v[PERF_COUNTER_CYCLES], v[PERF_COUNTER_INSTRUCTIONS],
+            v[PERF_COUNTER_CYCLES] ? (double)v[PERF_COUNTER_INSTRUCTIONS] / v[PERF_COUNTER_CYCLES] : 0.0,
+            v[PERF_COUNTER_CACHE_MISSES], v[PERF_COUNTER_BRANCH_MISSES]
+        );
+    }
+}
+
+typedef void (*JobFunction)(void *data, int idx);
+
+// fixed pool of workers that split a parallel for loop with the calling thread
+typedef struct {
+    pthread_t threads[JOB_THREADS_MAX];
+    int thread_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+    bool quit;
+
+    // the batch in flight, written under the mutex, next and done are atomic
+    unsigned int generation;
+    JobFunction function;
+    void *data;
+    State *state;
+    int perf_section; // of the caller, the workers count their part of the work into it
+    int count;
+    int next;
+    int done;
+    int active;
+} JobSystem;
+
+JobSystem jobs;
+
+static void run_jobs(JobFunction function, void *data, int count) {
+    for (;;) {
+        int idx = __atomic_fetch_add(&jobs.next, 1, __ATOMIC_RELAXED);
+        if (idx >= count) {
+            return;
+        }
+        function(data, idx);
+        if (__atomic_add_fetch(&jobs.done, 1, __ATOMIC_ACQ_REL) == count) {
+            pthread_mutex_lock(&jobs.mutex);
+            pthread_cond_signal(&jobs.finished);
+            pthread_mutex_unlock(&jobs.mutex);
+        }
+    }
+}
+
+void *job_thread(void *data) {
+    (void)data;
+    set_trace_thread_name("job worker");
+    pthread_mutex_lock(&jobs.mutex);
+    unsigned int seen = jobs.generation;
+    for (;;) {
+        while (!jobs.quit && jobs.generation == seen) {
+            pthread_cond_wait(&jobs.wake, &jobs.mutex);
+        }
+        if (jobs.quit) {
+            break;
+        }
+        seen = jobs.generation;
+        JobFunction function = jobs.function;
+        void *job_data = jobs.data;
+        int count = jobs.count;
+        int perf_section = jobs.perf_section;
+        state = jobs.state;
+        jobs.active++;
+        pthread_mutex_unlock(&jobs.mutex);
+
+        double trace_start = trace_begin();
+        if (perf_section >= 0) {
+            perf_begin(perf_section);
+        }
+        run_jobs(function, job_data, count);
+        end_perf_section(false);
+        trace_end("jobs", trace_start);
+
+        pthread_mutex_lock(&jobs.mutex);
+        jobs.active--;
+        if (jobs.active == 0) {
+            pthread_cond_signal(&jobs.finished);
+        }
+    }
+    pthread_mutex_unlock(&jobs.mutex);
+    return NULL;
+}
+
+void start_jobs(int thread_count) {
+    if (thread_count > JOB_THREADS_MAX) {
+        thread_count = JOB_THREADS_MAX;
+    }
+    pthread_mutex_init(&jobs.mutex, NULL);
+    pthread_cond_init(&jobs.wake, NULL);
+    pthread_cond_init(&jobs.finished, NULL);
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&jobs.threads[jobs.thread_count], NULL, job_thread, NULL) != 0) {
+            TraceLog(LOG_WARNING, "JOBS: Failed to start worker thread, continuing with %i", jobs.thread_count);
+            break;
+        }
+        jobs.thread_count++;
+    }
+}
+
+void stop_jobs(void) {
+    pthread_mutex_lock(&jobs.mutex);
+    jobs.quit = true;
+    pthread_cond_broadcast(&jobs.wake);
+    pthread_mutex_unlock(&jobs.mutex);
+    for (int i = 0; i < jobs.thread_count; i++) {
+        pthread_join(jobs.threads[i], NULL);
+    }
+    jobs.thread_count = 0;
+    pthread_cond_destroy(&jobs.finished);
+    pthread_cond_destroy(&jobs.wake);
+    pthread_mutex_destroy(&jobs.mutex);
+}
+
+// calls function(data, idx) for every idx in [0, count) and returns when all are done,
+// the workers see the caller's state so the usual grid helpers work inside jobs
+void run_parallel(JobFunction function, void *data, int count) {
+    if (jobs.thread_count == 0 || count <= 1) {
+        for (int i = 0; i < count; i++) {
+            function(data, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&jobs.mutex);
+    // a worker that woke up late for the previous batch may still be leaving it
+    while (jobs.active > 0) {
+        pthread_cond_wait(&jobs.finished, &jobs.mutex);
+    }
+    jobs.function = function;
+    jobs.data = data;
+    jobs.state = state;
+    jobs.perf_section = get_perf_section();
+    jobs.count = count;
+    jobs.next = 0;
+    jobs.done = 0;
+    jobs.generation++;
+    pthread_cond_broadcast(&jobs.wake);
+    pthread_mutex_unlock(&jobs.mutex);
+
+    run_jobs(function, data, count);
+
+    pthread_mutex_lock(&jobs.mutex);
+    while (__atomic_load_n(&jobs.done, __ATOMIC_ACQUIRE) < count || jobs.active > 0) {
+        pthread_cond_wait(&jobs.finished, &jobs.mutex);
+    }
+    pthread_mutex_unlock(&jobs.mutex);
+}
+
+enum {
+    EVENT_DOT,
+    EVENT_BIG_DOT,
+    EVENT_GHOST_STATE,
+    EVENT_PHASE,
+    EVENT_DEATH,
+    EVENT_LEVEL_CLEAR,
+    EVENT_LEVEL_START,
+};
+
+// fixed 16 byte record, an event log file is an EventLogHeader followed by these
+typedef struct {
+    unsigned int tick;
+    unsigned short type;
+    unsigned short level;
+    short x;
+    short y;
+    unsigned char ghost;
+    unsigned char from;
+    unsigned char to;
+    unsigned char padding;
+} GameEvent;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int record_size;
+    unsigned int simulation_rate;
+} EventLogHeader;
+
+// single producer (simulation thread) single consumer (writer thread), nothing on the producer side blocks
+typedef struct {
+    bool enabled;
+    FILE *file;
+    pthread_t thread;
+    int running;
+    unsigned int head __attribute__((aligned(64))); // written by the writer
+    unsigned int tail __attribute__((aligned(64))); // written by the simulation
+    int dropped;
+    GameEvent events[EVENT_LOG_SIZE];
+} EventLog;
+
+EventLog event_log;
+
+void log_event(GameEvent event) {
+    if (!event_log.enabled) {
+        return;
+    }
+    event.tick = state->tick;
+    event.level = (unsigned short)state->level_idx;
+
+    unsigned int tail = event_log.tail;
+    if (tail - __atomic_load_n(&event_log.head, __ATOMIC_ACQUIRE) == EVENT_LOG_SIZE) {
+        event_log.dropped++;
+        return;
+    }
+    event_log.events[tail & (EVENT_LOG_SIZE - 1)] = event;
+    __atomic_store_n(&event_log.tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void drain_event_log(void) {
+    unsigned int head = event_log.head;
+    unsigned int tail = __atomic_load_n(&event_log.tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        // write the contiguous part up to the end of the ring in one go
+        unsigned int start = head & (EVENT_LOG_SIZE - 1);
+        unsigned int count = tail - head;
+        if (start + count > EVENT_LOG_SIZE) {
+            count = EVENT_LOG_SIZE - start;
+        }
+        fwrite(&event_log.events[start], sizeof(GameEvent), count, event_log.file);
+        head += count;
+    }
+    __atomic_store_n(&event_log.head, head, __ATOMIC_RELEASE);
+}
+
+void *event_log_thread(void *data) {
+    (void)data;
+    while (__atomic_load_n(&event_log.running, __ATOMIC_ACQUIRE)) {
+        drain_event_log();
+        WaitTime(EVENT_LOG_FLUSH_INTERVAL);
+    }
+    drain_event_log();
+    return NULL;
+}
+
+bool start_event_log(const char *file_name) {
+    event_log.file = fopen(file_name, "wb");
+    if (event_log.file == NULL) {
+        TraceLog(LOG_ERROR, "EVENTS: [%s] Failed to open event log", file_name);
+        return false;
+    }
+    EventLogHeader header = {
+        .magic = EVENT_LOG_MAGIC,
+        .version = EVENT_LOG_VERSION,
+        .record_size = sizeof(GameEvent),
+        .simulation_rate = SIMULATION_RATE,
+    };
+    fwrite(&header, sizeof(header), 1, event_log.file);
+
+    event_log.running = 1;
+    if (pthread_create(&event_log.thread, NULL, event_log_thread, NULL) != 0) {
+        TraceLog(LOG_ERROR, "EVENTS: Failed to start event log thread");
+        fclose(event_log.file);
+        event_log.file = NULL;
+        return false;
+    }
+    event_log.enabled = true;
+    return true;
+}
+
+// call after the simulation stopped, everything logged so far reaches the file
+void stop_event_log(void) {
+    if (!event_log.enabled) {
+        return;
+    }
+    event_log.enabled = false;
+    __atomic_store_n(&event_log.running, 0, __ATOMIC_RELEASE);
+    pthread_join(event_log.thread, NULL);
+    fclose(event_log.file);
+    event_log.file = NULL;
+    if (event_log.dropped > 0) {
+        TraceLog(LOG_WARNING, "EVENTS: %i events dropped, the writer could not keep up", event_log.dropped);
+    }
+}
+
+void set_ghost_state(Ghost *ghost, int ghost_state) {
+    if (ghost->state == ghost_state) {
+        return;
+    }
+    log_event((GameEvent) {
+        .type = EVENT_GHOST_STATE,
+        .x = ghost->position.x,
+        .y = ghost->position.y,
+        .ghost = ghost - state->ghosts,
+        .from = ghost->state,
+        .to = ghost_state,
+    });
+    ghost->state = ghost_state;
+}
+
+void set_ghost_phase(int phase) {
+    if (state->ghost_phase == phase) {
+        return;
+    }
+    log_event((GameEvent) {
+        .type = EVENT_PHASE,
+        .from = state->ghost_phase,
+        .to = phase,
+    });
+    state->ghost_phase = phase;
+}
+
+// live numbers for external tools, every field has a single writer and is read without locks,
+// a reader may see fields from different ticks but never a torn value
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    int pid;
+
+    // render thread
+    float frame_time;
+    unsigned long long frames;
+    unsigned long long dropped_frames;
+
+    // simulation thread
+    float tick_rate;
+    unsigned long long ticks;
+    int level;
+    int dot_count;
+    int ghost_phase;
+    int ghost_states[GHOST_COUNT];
+} MetricsBlock;
+
+typedef struct {
+    MetricsBlock *block;
+    double tick_rate_start;
+    unsigned long long tick_rate_ticks;
+} Metrics;
+
+Metrics metrics;
+
+#define METRIC_STORE(field, value) do { __typeof__(field) metric_value_ = (value); __atomic_store(&(field), &metric_value_, __ATOMIC_RELAXED); } while (0)
+#define METRIC_ADD(field, value) __atomic_fetch_add(&(field), (value), __ATOMIC_RELAXED)
+
+bool start_metrics(const char *name) {
+#if defined(_WIN32)
+    (void)name;
+    TraceLog(LOG_WARNING, "METRICS: Shared memory metrics are not supported on this platform");
+    return false;
+#else
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] Failed to open shared memory", name);
+        return false;
+    }
+
+    // a block left behind by a run that did not exit cleanly is taken over, a live or different one is not
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] Failed to stat shared memory", name);
+        close(fd);
+        return false;
+    }
+    if (st.st_size != 0) {
+        const MetricsBlock *existing = NULL;
+        if (st.st_size == sizeof(MetricsBlock)) {
+            existing = mmap(NULL, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        if (existing == NULL || existing == MAP_FAILED) {
+            TraceLog(LOG_ERROR, "METRICS: [%s] Existing block is %lld bytes, not %zu, remove it or stop its owner", name, (long long)st.st_size, sizeof(MetricsBlock));
+            close(fd);
+            return false;
+        }
+        bool initialized = __atomic_load_n(&existing->magic, __ATOMIC_ACQUIRE) == METRICS_MAGIC;
+        unsigned int version = existing->version;
+        int pid = existing->pid;
+        munmap((void *)existing, sizeof(MetricsBlock));
+        if (initialized && version != METRICS_VERSION) {
+            TraceLog(LOG_ERROR, "METRICS: [%s] Existing block has version %u, expected %u", name, version, METRICS_VERSION);
+            close(fd);
+            return false;
+        }
+        if (initialized && pid > 0 && pid != getpid() && kill(pid, 0) == 0) {
+            TraceLog(LOG_ERROR, "METRICS: [%s] Already published by running process %i", name, pid);
+            close(fd);
+            return false;
+        }
+    }
+
+    if (ftruncate(fd, sizeof(MetricsBlock)) != 0) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] Failed to size shared memory", name);
+        close(fd);
+        return false;
+    }
+    void *memory = mmap(NULL, sizeof(MetricsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] Failed to map shared memory", name);
+        return false;
+    }
+    metrics.block = memory;
+    memset(metrics.block, 0, sizeof(MetricsBlock));
+    metrics.block->version = METRICS_VERSION;
+    metrics.block->pid = getpid();
+    metrics.tick_rate_start = get_wall_time();
+    // readers check the magic last so they never see a half initialized block
+    __atomic_store_n(&metrics.block->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    TraceLog(LOG_INFO, "METRICS: Publishing to shared memory [%s]", name);
+    return true;
+#endif
+}
+
+void stop_metrics(const char *name) {
+#if defined(_WIN32)
+    (void)name;
+#else
+    if (metrics.block == NULL) {
+        return;
+    }
+    munmap(metrics.block, sizeof(MetricsBlock));
+    metrics.block = NULL;
+    shm_unlink(name);
+#endif
+}
+
+// simulation thread, after every tick
+void publish_tick_metrics(void) {
+    MetricsBlock *block = metrics.block;
+    if (block == NULL) {
+        return;
+    }
+    METRIC_ADD(block->ticks, 1);
+    METRIC_STORE(block->level, state->level_idx);
+    METRIC_STORE(block->dot_count, state->dot_count);
+    METRIC_STORE(block->ghost_phase, state->ghost_phase);
+    for (int i = 0; i < GHOST_COUNT; i++) {
+        METRIC_STORE(block->ghost_states[i], state->ghosts[i].state);
+    }
+
+    metrics.tick_rate_ticks++;
+    double now = get_wall_time();
+    if (now - metrics.tick_rate_start >= 1.0) {
+        METRIC_STORE(block->tick_rate, (float)(metrics.tick_rate_ticks / (now - metrics.tick_rate_start)));
+        metrics.tick_rate_start = now;
+        metrics.tick_rate_ticks = 0;
+    }
+}
+
+// render thread, after every presented frame
+void publish_frame_metrics(float frame_time) {
+    MetricsBlock *block = metrics.block;
+    if (block == NULL) {
+        return;
+    }
+    METRIC_STORE(block->frame_time, frame_time);
+    METRIC_ADD(block->frames, 1);
+    if (frame_time > METRICS_DROPPED_FRAME_TIME) {
+        METRIC_ADD(block->dropped_frames, 1);
+    }
+}
+
+// --watch-metrics, prints the block of a running game once per second
+int watch_metrics(const char *name) {
+#if defined(_WIN32)
+    (void)name;
+    TraceLog(LOG_ERROR, "METRICS: Shared memory metrics are not supported on this platform");
+    return 1;
+#else
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] No running game is publishing metrics", name);
+        return 1;
+    }
+    const MetricsBlock *block = mmap(NULL, sizeof(MetricsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] Failed to map shared memory", name);
+        return 1;
+    }
+    if (__atomic_load_n(&block->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC || block->version != METRICS_VERSION) {
+        TraceLog(LOG_ERROR, "METRICS: [%s] Unknown metrics layout", name);
+        munmap((void *)block, sizeof(MetricsBlock));
+        return 1;
+    }
+
+    MetricsBlock copy;
+    do {
+        __atomic_load(&block->frame_time, &copy.frame_time, __ATOMIC_RELAXED);
+        __atomic_load(&block->tick_rate, &copy.tick_rate, __ATOMIC_RELAXED);
+        copy.frames = __atomic_load_n(&block->frames, __ATOMIC_RELAXED);
+        copy.dropped_frames = __atomic_load_n(&block->dropped_frames, __ATOMIC_RELAXED);
+        copy.ticks = __atomic_load_n(&block->ticks, __ATOMIC_RELAXED);
+        copy.level = __atomic_load_n(&block->level, __ATOMIC_RELAXED);
+        copy.dot_count = __atomic_load_n(&block->dot_count, __ATOMIC_RELAXED);
+        copy.ghost_phase = __atomic_load_n(&block->ghost_phase, __ATOMIC_RELAXED);
+        for (int i = 0; i < GHOST_COUNT; i++) {
+            copy.ghost_states[i] = __atomic_load_n(&block->ghost_states[i], __ATOMIC_RELAXED);
+        }
+        printf(
+            "frame %6.2f ms  frames %8llu  dropped %6llu  ticks %9llu  %6.1f/s  level %3i  dots %6i  phase %i  ghosts %i %i %i %i\n",
+            copy.frame_time * 1000.0f, copy.frames, copy.dropped_frames, copy.ticks, copy.tick_rate,
+            copy.level, copy.dot_count, copy.ghost_phase,
+            copy.ghost_states[0], copy.ghost_states[1], copy.ghost_states[2], copy.ghost_states[3]
+        );
+        fflush(stdout);
+        WaitTime(1.0);
+    } while (kill(block->pid, 0) == 0);
+
+    munmap((void *)block, sizeof(MetricsBlock));
+    return 0;
+#endif
+}
+
+void level_setup() {
+    double trace_start = trace_begin();
+    state->death_by_ghost = NULL;
+    state->level_idx++;
+    state->level_intro = 0;
+    state->death_timer = 0;
+
+    state->level_scatter_min = get_level_var(2, 0);
+    state->level_scatter_max = get_level_var(5, 1);
+    state->level_chase_min = get_level_var(5, 10);
+    state->level_chase_max = get_level_var(10, 20);
+    state->red_ghost_speed = (SPEED_GHOST_OUTSIDE * get_level_var(120, 150)) / 100;
+
+    state->ghost_scatter_timer = 0;
+    state->ghost_scatter_target_time = SECONDS_TO_TICKS(rng_between(&state->rng, state->level_scatter_min, state->level_scatter_max));
+
+    ASSERT(state->maze_count > 0);
+    Maze *maze = &state->mazes[(state->level_idx - 1 + state->maze_offset) % state->maze_count];
+    const LevelTemplate *template = get_level_template(maze);
+    state->level = maze->header;
+    state->paths = NULL;
+    if (maze->header->width * maze->header->height >= PATH_HIERARCHY_MIN_CELLS) {
+        state->paths = get_path_hierarchy(maze);
+    }
+    state->heatmap = (record_heatmaps && heatmap_alloc(maze)) ? &maze->heatmap : NULL;
+    state->dot_count = template->dot_count;
+
+    ASSERT(template->grid_size <= state->grid_size);
+    state->grid_width = maze->header->width;
+    state->grid_height = maze->header->height;
+    state->grid_tiles_x = template->tiles_x;
+    memcpy(state->grid, maze->cells, template->grid_size);
+    state->grid_version++;
+    state->grid_reset_version = state->grid_version;
+
+    state->ghost_phase = PHASE_SCATTER;
+    log_event((GameEvent) { .type = EVENT_LEVEL_START });
+
+    state->ghost_frightened_target_time = SECONDS_TO_TICKS((state->level_idx < 10) ? (10 - state->level_idx) : 0);
+
+    state->player = (Player) {
+        .position = CELL_PLAYER_START,
+        .direction = DIRECTION_NONE,
+        .requested_direction = DIRECTION_NONE,
+        .fraction_position = (SubcellOffset) {0},
+    };
+
+    state->ghosts[GHOST_BLINKY].state = GHOST_STATE_OUTSIDE;
+    state->ghosts[GHOST_BLINKY].shape = GHOST_SHAPE_TRAPEZOID;
+    state->ghosts[GHOST_BLINKY].position = CELL_OUTSIDE_GHOST_HOUSE_DOOR;
+    state->ghosts[GHOST_BLINKY].direction = DIRECTION_LEFT;
+    state->ghosts[GHOST_BLINKY].color = COLOR_BLINKY;
+    state->ghosts[GHOST_BLINKY].get_target = get_blinky_target;
+
+    state->ghosts[GHOST_PINKY].state = GHOST_STATE_INSIDE;
+    state->ghosts[GHOST_PINKY].shape = GHOST_SHAPE_TRAPEZOID;
+    state->ghosts[GHOST_PINKY].position = CELL_GHOST_HOUSE_LEFT_SIDE;
+    state->ghosts[GHOST_PINKY].direction = DIRECTION_RIGHT;
+    state->ghosts[GHOST_PINKY].color = COLOR_PINKY;
+    state->ghosts[GHOST_PINKY].get_target = get_pinky_target;
+
+    state->ghosts[GHOST_INKY].state = GHOST_STATE_INSIDE;
+    state->ghosts[GHOST_INKY].shape = GHOST_SHAPE_TRAPEZOID;
+    state->ghosts[GHOST_INKY].position = CELL_GHOST_HOUSE_CENTER;
+    state->ghosts[GHOST_INKY].direction = DIRECTION_RIGHT;
+    state->ghosts[GHOST_INKY].color = COLOR_INKY;
+    state->ghosts[GHOST_INKY].get_target = get_inky_target;
+
+    state->ghosts[GHOST_CLYDE].state = GHOST_STATE_INSIDE;
+    state->ghosts[GHOST_CLYDE].shape = GHOST_SHAPE_TRAPEZOID;
+    state->ghosts[GHOST_CLYDE].position = CELL_GHOST_HOUSE_RIGHT_SIDE;
+    state->ghosts[GHOST_CLYDE].direction = DIRECTION_LEFT;
+    state->ghosts[GHOST_CLYDE].color = COLOR_CLYDE;
+    state->ghosts[GHOST_CLYDE].get_target = get_clyde_target;
+
+    ASSERT(state->level_idx > 0);
+    switch (state->level_idx) {
+        case 1:
+            state->ghosts[GHOST_BLINKY].wait_amount = 0;
+            state->ghosts[GHOST_PINKY].wait_amount = 2;
+            state->ghosts[GHOST_INKY].wait_amount = 22;
+            state->ghosts[GHOST_CLYDE].wait_amount = 42;
+            break;
+        case 2:
+            state->ghosts[GHOST_BLINKY].wait_amount = 0;
+            state->ghosts[GHOST_PINKY].wait_amount = 2;
+            state->ghosts[GHOST_INKY].wait_amount = 4;
+            state->ghosts[GHOST_CLYDE].wait_amount = 24;
+            break;
+        case 3:
+            state->ghosts[GHOST_BLINKY].wait_amount = 0;
+            state->ghosts[GHOST_PINKY].wait_amount = 2;
+            state->ghosts[GHOST_INKY].wait_amount = 4;
+            state->ghosts[GHOST_CLYDE].wait_amount = 6;
+            break;
+    }
+    trace_end("level_setup", trace_start);
+}
+
+enum {
+    ASSET_FRIGHTENED,
+    ASSET_RETURNING,
+    ASSET_BLINKY,
+    ASSET_PINKY,
+    ASSET_INKY,
+    ASSET_CLYDE,
+    ASSET_COUNT,
+};
+
+enum {
+    SPRITE_SIZE_CELL,
+    SPRITE_SIZE_BLINKY,
+    SPRITE_SIZE_COUNT,
+};
+
+static const char *asset_file_names[ASSET_COUNT] = {
+    [ASSET_FRIGHTENED] = "frightened.png",
+    [ASSET_RETURNING] = "returning.png",
+    [ASSET_BLINKY] = "blinky.png",
+    [ASSET_PINKY] = "pinky.png",
+    [ASSET_INKY] = "inky.png",
+    [ASSET_CLYDE] = "clyde.png",
+};
+
+typedef struct {
+    Image image; // kept after the upload, the sprites are scaled down from it
+    int decoded; // set by the loader thread once image is usable
+    bool uploaded;
+    Texture texture; // full resolution, only used for the death zoom
+    Texture sprites[SPRITE_SIZE_COUNT]; // scaled to match the cell size on screen
+} Asset;
+
+// images are decoded on a thread while the window opens and the level intro plays,
+// the main thread only uploads them to the gpu as they become ready
+typedef struct {
+    Asset assets[ASSET_COUNT];
+    int uploaded_count;
+    pthread_t thread;
+    bool thread_running;
+    double start_time;
+    int sprite_sizes[SPRITE_SIZE_COUNT];
+} Assets;
+
+Assets assets;
+
+// embedded builds use the pixels baked into the executable, others decode the png next to it
+static Image decode_asset(const char *file_name) {
+#if EMBEDDED_ASSETS
+    for (int i = 0; i < (int)(sizeof(embedded_assets) / sizeof(embedded_assets[0])); i++) {
+        const EmbeddedAsset *asset = &embedded_assets[i];
+        if (TextIsEqual(asset->file_name, file_name)) {
+            return (Image) {
+                .data = asset->data,
+                .width = asset->width,
+                .height = asset->height,
+                .mipmaps = 1,
+                .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+            };
+        }
+    }
+    TraceLog(LOG_ERROR, "ASSET: [%s] Not embedded", file_name);
+    return (Image){0};
+#else
+    Image image = LoadImage(file_name);
+    if (image.data == NULL) {
+        TraceLog(LOG_ERROR, "ASSET: [%s] Failed to load, run the game from the directory containing the images", file_name);
+    }
+    return image;
+#endif
+}
+
+static void *asset_loader_thread(void *arg) {
+    (void)arg;
+    set_trace_thread_name("asset loader");
+    for (int i = 0; i < ASSET_COUNT; i++) {
+        Asset *asset = &assets.assets[i];
+        double trace_start = trace_begin();
+        asset->image = decode_asset(asset_file_names[i]);
+        trace_end_detail("decode texture", asset_file_names[i], trace_start);
+        mark_startup_phase("decode", asset_file_names[i]);
+        __atomic_store_n(&asset->decoded, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// does not need the window, so it can start before InitWindow()
+void start_asset_loading(void) {
+    assets.start_time = get_wall_time();
+
+#if EMBEDDED_ASSETS
+    // nothing to decode
+    asset_loader_thread(NULL);
+#else
+    assets.thread_running = pthread_create(&assets.thread, NULL, asset_loader_thread, NULL) == 0;
+    if (!assets.thread_running) {
+        asset_loader_thread(NULL);
+    }
+#endif
+}
+
+// called every frame on the main thread, returns true once every texture is on the gpu
+bool upload_assets(void) {
+    if (assets.uploaded_count == ASSET_COUNT) {
+        return true;
+    }
+
+    for (int i = 0; i < ASSET_COUNT; i++) {
+        Asset *asset = &assets.assets[i];
+        if (asset->uploaded || !__atomic_load_n(&asset->decoded, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        double trace_start = trace_begin();
+        if (asset->image.data != NULL) {
+            asset->texture = LoadTextureFromImage(asset->image);
+        }
+        trace_end_detail("upload texture", asset_file_names[i], trace_start);
+        mark_startup_phase("upload", asset_file_names[i]);
+        asset->uploaded = true;
+        assets.uploaded_count++;
+    }
+
+    if (assets.uploaded_count < ASSET_COUNT) {
+        return false;
+    }
+
+    if (assets.thread_running) {
+        pthread_join(assets.thread, NULL);
+        assets.thread_running = false;
+    }
+    TraceLog(LOG_INFO, "ASSET: All textures ready after %.2f ms", (get_wall_time() - assets.start_time) * 1000.0);
+    return true;
+}
+
+// drawing the 192px images at a few dozen pixels every frame wastes fill rate and aliases,
+// so every sprite is kept pre-scaled to the size it is drawn at and rebuilt when the window is resized
+void update_sprite_cache(void) {
+    int sizes[SPRITE_SIZE_COUNT] = {
+        [SPRITE_SIZE_CELL] = (int)ceilf(get_cell_size()),
+        [SPRITE_SIZE_BLINKY] = (int)ceilf(get_cell_size() * 1.5f),
+    };
+
+    for (int size = 0; size < SPRITE_SIZE_COUNT; size++) {
+        if (sizes[size] == assets.sprite_sizes[size]) {
+            continue;
+        }
+        assets.sprite_sizes[size] = sizes[size];
+
+        for (int i = 0; i < ASSET_COUNT; i++) {
+            Asset *asset = &assets.assets[i];
+            if (asset->sprites[size].id != 0) {
+                UnloadTexture(asset->sprites[size]);
+                asset->sprites[size] = (Texture){0};
+            }
+            if (asset->image.data == NULL || sizes[size] >= asset->image.width) {
+                continue; // never scale up, the full resolution texture is used instead
+            }
+
+            Image image = ImageCopy(asset->image);
+            ImageResize(&image, sizes[size], sizes[size]);
+            asset->sprites[size] = LoadTextureFromImage(image);
+            SetTextureFilter(asset->sprites[size], TEXTURE_FILTER_BILINEAR);
+            UnloadImage(image);
+        }
+    }
+}
+
+Texture get_sprite(int asset, int size) {
+    if (assets.assets[asset].sprites[size].id != 0) {
+        return assets.assets[asset].sprites[size];
+    }
+    return assets.assets[asset].texture;
+}
+
+void unload_assets(void) {
+    for (int i = 0; i < ASSET_COUNT; i++) {
+        Asset *asset = &assets.assets[i];
+        for (int size = 0; size < SPRITE_SIZE_COUNT; size++) {
+            UnloadTexture(asset->sprites[size]);
+        }
+        UnloadTexture(asset->texture);
+#if !EMBEDDED_ASSETS
+        UnloadImage(asset->image);
+#endif
+    }
+}
+
+static inline int get_ghost_asset(Ghost *ghost) {
+    return ASSET_BLINKY + (int)(ghost - state->ghosts);
+}
+
+void init(void) {
+    if (state->maze_count == 0) {
+        state->mazes = calloc(1, sizeof(Maze));
+        if (maze_create_builtin(&state->mazes[0])) {
+            state->maze_count = 1;
+        }
+    }
+
+    // one grid big enough for every maze so switching mazes never allocates
+    for (int i = 0; i < state->maze_count; i++) {
+        size_t grid_size = get_grid_size(state->mazes[i].header->width, state->mazes[i].header->height);
+        if (grid_size > state->grid_size) {
+            state->grid_size = grid_size;
+        }
+    }
+    state->grid = malloc(state->grid_size);
+    state->rng.state = (unsigned long long)(get_wall_time() * 1e9);
+
+    level_setup();
+    mark_startup_phase("level_setup", NULL);
+}
+
+void player_on_position_new() {
+    Player *player = &state->player;
+
+    player->position = wrap_teleport(player->position);
+    record_visit(HEATMAP_PLAYER, player->position);
+
+    if (has_flag(player->position, FLAG_DOT)) {
+        remove_flag(player->position, FLAG_DOT);
+        state->dot_count--;
+        log_event((GameEvent) { .type = EVENT_DOT, .x = player->position.x, .y = player->position.y });
+    } else if (has_flag(player->position, FLAG_BIG_DOT)) {
+        remove_flag(player->position, FLAG_BIG_DOT);
+        state->dot_count--;
+        log_event((GameEvent) { .type = EVENT_BIG_DOT, .x = player->position.x, .y = player->position.y });
+
+        set_ghost_phase(PHASE_FRIGHTENED);
+        state->ghost_frightened_timer = 0;
+
+        for (int i = 0; i < GHOST_COUNT; i++) {
+            Ghost *ghost = &state->ghosts[i];
+            switch (ghost->state) {
+                default:
+                    break;
+                case GHOST_STATE_OUTSIDE:
+                    set_ghost_state(ghost, GHOST_STATE_FRIGHTENED);
+                    break;
+            }
+        }
+    }
+
+    if (state->dot_count == 0) {
+        log_event((GameEvent) { .type = EVENT_LEVEL_CLEAR, .x = player->position.x, .y = player->position.y });
+        level_setup();
+    }
+}
+
+void scan_surroundings(GridPosition from, int current_direction, Surroundings *surroundings) {
+    ASSERT(surroundings->count == 0);
+
+    for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+        int opposite_direction = get_opposite_direction(current_direction);
+        if (direction == opposite_direction) {
             continue;
         }
 
@@ -686,25 +3741,370 @@ int get_best_direction_towards_target(Surroundings *surroundings, GridPosition t
     return best_direction;
 }
 
-void update(void) {
-    if (state->level_intro < LEVEL_INTRO_LENGTH) {
-        return;
+// like get_best_direction_towards_target() but by the length of the way there instead of the straight line,
+// small mazes and targets inside walls or off the maze (the scatter corners) keep the straight line
+int get_shortest_direction_towards_target(Surroundings *surroundings, GridPosition target) {
+    PathHierarchy *paths = state->paths;
+    if (paths == NULL || is_out_of_bounds(target) || has_flag(target, FLAG_WALL)) {
+        return get_best_direction_towards_target(surroundings, target);
+    }
+    // the player is chased by most ghosts at once, so it gets a field over the whole maze instead of a search
+    PathFlow *flow = grid_position_eq(target, state->player.position) ? get_path_flow(paths, state->grid, target) : NULL;
+    PathField *field = (flow == NULL) ? get_path_field(paths, state->grid, target) : NULL;
+    if (flow == NULL && field == NULL) {
+        return get_best_direction_towards_target(surroundings, target);
+    }
+
+    int closest_distance = PATH_DISTANCE_MAX;
+    int best_direction = DIRECTION_NONE;
+
+    for (int i = 0; i < surroundings->count; i++) {
+        GridPosition position = surroundings->positions[i];
+        if (flow != NULL) {
+            int distance = get_path_flow_distance(paths, flow, state->grid, position);
+            if (distance >= 0 && distance <= closest_distance) {
+                closest_distance = distance;
+                best_direction = surroundings->directions[i];
+            }
+            continue;
+        }
+
+        int extra = 0;
+        if (is_out_of_bounds(position)) {
+            // the tunnel cell outside, one more step to the other side
+            position.x = (position.x + GRID_WIDTH) % GRID_WIDTH;
+            position.y = (position.y + GRID_HEIGHT) % GRID_HEIGHT;
+            extra = 1;
+        }
+        int distance = get_path_distance(paths, field, position);
+        if (distance == PATH_DISTANCE_MAX) {
+            continue;
+        }
+
+        if (distance + extra <= closest_distance) {
+            closest_distance = distance + extra;
+            best_direction = surroundings->directions[i];
+        }
+    }
+
+    if (best_direction == DIRECTION_NONE) {
+        return get_best_direction_towards_target(surroundings, target);
+    }
+    return best_direction;
+}
+
+static float get_camera_offset(float screen_size, float level_size, float focus) {
+    if (level_size <= screen_size) {
+        return (screen_size - level_size) / 2;
+    }
+    // keep the focus in the middle but never show anything beyond the edges of the maze
+    float offset = (screen_size / 2) - focus;
+    if (offset > 0) {
+        return 0;
     }
+    if (offset < screen_size - level_size) {
+        return screen_size - level_size;
+    }
+    return offset;
+}
 
+// centers the maze when it fits on screen, otherwise follows the player
+void update_camera(void) {
+    Vector2 player = get_player_grid_position();
+    player.x *= get_cell_size();
+    player.y *= get_cell_size();
+
+    state->render_offset.x = get_camera_offset(GetScreenWidth(), get_cell_size() * GRID_WIDTH, player.x);
+    state->render_offset.y = get_camera_offset(GetScreenHeight(), get_cell_size() * GRID_HEIGHT, player.y);
+}
+
+// the intro keeps playing until the textures are uploaded, so a slow disk never shows missing sprites
+static inline bool is_level_intro(void) {
+    return state->level_intro < LEVEL_INTRO_LENGTH || !state->assets_ready;
+}
+
+typedef struct {
+    State state;
+    size_t grid_capacity;
+    unsigned long long grid_version;
+} Snapshot;
+
+// triple buffer, the simulation always has a slot to write and the renderer always has a complete one to read
+typedef struct {
+    Snapshot snapshots[SNAPSHOT_COUNT];
+    int back;   // simulation thread only
+    int front;  // render thread only
+    int middle; // exchanged atomically, SNAPSHOT_FRESH is set when the simulation published since the last acquire
+} SnapshotBuffer;
+
+typedef struct {
+    double time; // when the frame that saw the press polled input, only used to measure latency
+    int direction;
+} InputEvent;
+
+// single producer (main thread) single consumer (simulation thread)
+typedef struct {
+    InputEvent events[INPUT_QUEUE_SIZE];
+    unsigned int head; // written by the consumer
+    unsigned int tail; // written by the producer
+    int dropped;
+} InputQueue;
+
+typedef struct {
+    int count;
+    double present_total;
+    double present_max;
+    double last_presented;
+} InputLatency;
+
+typedef struct {
+    State *state;
+    SnapshotBuffer buffer;
+    pthread_t thread;
+    bool thread_started;
+    int running;
+    int assets_ready;
+    InputQueue input;
+    double apply_latency_total; // simulation thread only
+    int apply_latency_count; // simulation thread only
+} Simulation;
+
+Simulation simulation;
+
+// simulation thread
+void publish_snapshot(void) {
+    SnapshotBuffer *buffer = &simulation.buffer;
+    Snapshot *snapshot = &buffer->snapshots[buffer->back];
+
+    // the snapshot keeps its own grid, everything else is plain data
+    unsigned char *grid = snapshot->state.grid;
+    if (snapshot->grid_capacity < state->grid_size) {
+        free(grid);
+        grid = malloc(state->grid_size);
+        snapshot->grid_capacity = state->grid_size;
+        snapshot->grid_version = 0; // older than any level_setup(), so the first publish copies everything
+    }
+    snapshot->state = *state;
+    snapshot->state.grid = grid;
+    if (snapshot->grid_version != state->grid_version) {
+        // a slot is at most a few publishes behind, so normally it only replays the cells written since
+        unsigned long long behind = state->grid_version - snapshot->grid_version;
+        if (snapshot->grid_version >= state->grid_reset_version && behind <= GRID_CHANGES_MAX) {
+            for (unsigned long long version = snapshot->grid_version + 1; version <= state->grid_version; version++) {
+                int idx = state->grid_changes[version & (GRID_CHANGES_MAX - 1)];
+                grid[idx] = state->grid[idx];
+            }
+        } else {
+            memcpy(grid, state->grid, state->grid_size);
+        }
+        snapshot->grid_version = state->grid_version;
+    }
     if (state->death_by_ghost) {
+        snapshot->state.death_by_ghost = &snapshot->state.ghosts[state->death_by_ghost - state->ghosts];
+    }
+
+    int previous = __atomic_exchange_n(&buffer->middle, buffer->back | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL);
+    buffer->back = previous & (SNAPSHOT_FRESH - 1);
+}
+
+// render thread, returns the newest published state, or the previous one again if nothing new arrived
+State *acquire_snapshot(void) {
+    SnapshotBuffer *buffer = &simulation.buffer;
+    if (__atomic_load_n(&buffer->middle, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH) {
+        int previous = __atomic_exchange_n(&buffer->middle, buffer->front, __ATOMIC_ACQ_REL);
+        buffer->front = previous & (SNAPSHOT_FRESH - 1);
+    }
+    return &buffer->snapshots[buffer->front].state;
+}
+
+// main thread
+void push_input_event(double time, int direction) {
+    InputQueue *queue = &simulation.input;
+    unsigned int tail = queue->tail;
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - head == INPUT_QUEUE_SIZE) {
+        queue->dropped++;
         return;
     }
+    queue->events[tail & (INPUT_QUEUE_SIZE - 1)] = (InputEvent) {
+        .time = time,
+        .direction = direction,
+    };
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// main thread, raylib input may only be polled where the window lives
+void handle_input(void) {
+    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
+        if (IsKeyPressed(KEY_RIGHT)) {
+            int monitor = GetCurrentMonitor();
+            int monitor_width = GetMonitorWidth(monitor);
+            int screen_width = GetScreenWidth();
+            SetWindowPosition(monitor_width - screen_width, 0);
+        }
+        if (IsKeyPressed(KEY_LEFT)) {
+            SetWindowPosition(0, 0);
+        }
+    }
 
-    float delta_time = GET_FRAME_TIME();
+    // raylib queues presses in the order they happened, every press is queued and applied one per tick
+    // it only polls window events once per frame and keeps no event time, so presses share the poll time
+    double time = get_wall_time();
+    for (int key = GetKeyPressed(); key != 0; key = GetKeyPressed()) {
+        int direction;
+        switch (key) {
+            default: continue;
+            case KEY_RIGHT: direction = DIRECTION_RIGHT; break;
+            case KEY_UP: direction = DIRECTION_UP; break;
+            case KEY_LEFT: direction = DIRECTION_LEFT; break;
+            case KEY_DOWN: direction = DIRECTION_DOWN; break;
+        }
+        push_input_event(time, direction);
+    }
 
-    {
-        state->global_sine_timer += delta_time;
+    if (IsKeyPressed(KEY_F9)) {
+        toggle_trace();
+    }
+    if (IsKeyPressed(KEY_H)) {
+        cycle_heatmap_overlay();
+    }
+
+#if DEBUG
+    if (IsKeyPressed(KEY_S)) {
+        toggle_slowmotion();
+    }
+    if (IsKeyPressed(KEY_L)) {
+        toggle_lines();
+    }
+#endif
+}
+
+// simulation thread, applies the oldest pushed event, so presses from one frame land on consecutive ticks in order
+// instead of the last one overwriting the others, while input is ignored the queue is emptied
+// the press times are only frame accurate so they can not place a press between ticks
+void apply_input_events(bool apply) {
+    InputQueue *queue = &simulation.input;
+    unsigned int head = queue->head;
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (!apply) {
+        head = tail;
+    } else if (head != tail) {
+        InputEvent *event = &queue->events[head & (INPUT_QUEUE_SIZE - 1)];
+        state->player.requested_direction = event->direction;
+        state->input_time = event->time;
+        simulation.apply_latency_total += get_wall_time() - event->time;
+        simulation.apply_latency_count++;
+        head++;
+    }
+    __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+}
+
+InputLatency input_latency;
+
+// main thread, call after presenting, times input events from key press to the first frame that shows them
+void track_input_latency(void) {
+    if (state->input_time == 0 || state->input_time == input_latency.last_presented) {
+        return;
+    }
+    double latency = get_wall_time() - state->input_time;
+    input_latency.last_presented = state->input_time;
+    input_latency.count++;
+    input_latency.present_total += latency;
+    if (latency > input_latency.present_max) {
+        input_latency.present_max = latency;
+    }
+}
+
+void print_input_latency(void) {
+    if (input_latency.count == 0) {
+        return;
+    }
+    TraceLog(
+        LOG_INFO,
+        "INPUT: %i events, press to tick %.2f ms avg, press to present %.2f ms avg %.2f ms max, %i dropped",
+        input_latency.count,
+        simulation.apply_latency_count ? (simulation.apply_latency_total / simulation.apply_latency_count) * 1000.0 : 0.0,
+        (input_latency.present_total / input_latency.count) * 1000.0,
+        input_latency.present_max * 1000.0,
+        simulation.input.dropped
+    );
+}
+
+// how many of the coming ticks, up to the given amount, are quiet: no actor reaches a new cell, no timer expires,
+// no ghost can reach the player and no turn is pending. quiet ticks only add time and subcells,
+// so update_step() can take all of them at once and lands exactly where single ticks would
+int get_quiet_ticks(int ticks) {
+    if (is_level_intro()) {
+        return min_int(ticks, LEVEL_INTRO_LENGTH - state->level_intro);
+    }
+    if (state->death_by_ghost) {
+        return min_int(ticks, SECONDS_TO_TICKS(1) - 1 - state->death_timer);
+    }
+
+    switch (state->ghost_phase) {
+        default: break;
+        case PHASE_SCATTER:
+            ticks = min_int(ticks, state->ghost_scatter_target_time - state->ghost_scatter_timer);
+            break;
+        case PHASE_CHASE:
+            ticks = min_int(ticks, state->ghost_chase_target_time - state->ghost_chase_timer);
+            break;
+        case PHASE_FRIGHTENED:
+            ticks = min_int(ticks, state->ghost_frightened_target_time - state->ghost_frightened_timer);
+            break;
+    }
+
+    Player *player = &state->player;
+    if (player->direction != player->requested_direction) {
+        return 0;
+    }
+
+    int progress = 0; // subcells travelled towards the next cell
+    switch (player->direction) {
+        default: break;
+        case DIRECTION_RIGHT: progress = player->fraction_position.x; break;
+        case DIRECTION_UP: progress = -player->fraction_position.y; break;
+        case DIRECTION_LEFT: progress = -player->fraction_position.x; break;
+        case DIRECTION_DOWN: progress = player->fraction_position.y; break;
+    }
+    ticks = min_int(ticks, (SUBCELL_COUNT - 1 - progress) / SPEED_PLAYER);
+
+    SubcellOffset player_position = get_player_subcell_position();
+    for (int i = 0; i < GHOST_COUNT; i++) {
+        Ghost *ghost = &state->ghosts[i];
+        int speed = get_ghost_speed(ghost);
+        ticks = min_int(ticks, (SUBCELL_COUNT - 1 - ghost->fraction_position) / speed);
+
+        // the gap along the longer axis shrinks by at most both speeds per tick
+        SubcellOffset ghost_position = get_ghost_subcell_position(ghost);
+        int gap = max_int(abs(player_position.x - ghost_position.x), abs(player_position.y - ghost_position.y));
+        ticks = min_int(ticks, (gap - COLLISION_DISTANCE) / (SPEED_PLAYER + speed));
+    }
+
+    return max_int(ticks, 0);
+}
+
+void update_step(int ticks) {
+    state->tick += ticks;
+
+    if (is_level_intro()) {
+        state->level_intro += ticks;
+        return;
+    }
 
-        if (state->global_sine_timer > 1.0f) {
-            state->global_sine_timer = 0.0f;
+    if (state->death_by_ghost) {
+        state->death_timer += ticks;
+        if (state->death_timer >= SECONDS_TO_TICKS(1)) {
+            state->level_idx = 0;
+            level_setup();
         }
+        return;
+    }
+
+    {
+        state->global_sine_timer = (state->global_sine_timer + ticks) % (SECONDS_TO_TICKS(1) + 1);
 
-        float x = state->global_sine_timer * PI * 2;
+        float x = TICKS_TO_SECONDS(state->global_sine_timer) * PI * 2;
         state->global_sine = sinf(x);
         state->global_cosine = sinf(x);
     }
@@ -712,66 +4112,48 @@ void update(void) {
     switch (state->ghost_phase) {
         default: break;
         case PHASE_SCATTER:
-            state->ghost_scatter_timer += delta_time;
+            state->ghost_scatter_timer += ticks;
             if (state->ghost_scatter_timer > state->ghost_scatter_target_time) {
-                state->ghost_scatter_timer = 0.0f;
-                state->ghost_phase = PHASE_CHASE;
-                state->ghost_chase_target_time = GetRandomValue(
+                state->ghost_scatter_timer = 0;
+                set_ghost_phase(PHASE_CHASE);
+                state->ghost_chase_target_time = SECONDS_TO_TICKS(rng_between(
+                    &state->rng,
                     state->level_chase_min,
                     state->level_chase_max
-                );
+                ));
             }
             break;
         case PHASE_CHASE:
-            state->ghost_chase_timer += delta_time;
+            state->ghost_chase_timer += ticks;
             if (state->ghost_chase_timer > state->ghost_chase_target_time) {
-                state->ghost_chase_timer = 0.0f;
-                state->ghost_phase = PHASE_SCATTER;
-                state->ghost_scatter_target_time = GetRandomValue(
+                state->ghost_chase_timer = 0;
+                set_ghost_phase(PHASE_SCATTER);
+                state->ghost_scatter_target_time = SECONDS_TO_TICKS(rng_between(
+                    &state->rng,
                     state->level_scatter_min,
                     state->level_scatter_max
-                );
+                ));
             }
             break;
         case PHASE_FRIGHTENED:
-            state->ghost_frightened_timer += delta_time;
+            state->ghost_frightened_timer += ticks;
             if (state->ghost_frightened_timer > state->ghost_frightened_target_time) {
-                state->ghost_frightened_timer = 0.0f;
+                state->ghost_frightened_timer = 0;
                 for (int i = 0; i < GHOST_COUNT; i++) {
                     if (state->ghosts[i].state == GHOST_STATE_FRIGHTENED) {
-                        state->ghosts[i].state = GHOST_STATE_OUTSIDE;
+                        set_ghost_state(&state->ghosts[i], GHOST_STATE_OUTSIDE);
                     }
                 }
+                int phase = state->ghost_phase;
                 if (state->ghost_scatter_timer < state->ghost_scatter_target_time) {
-                    state->ghost_phase = PHASE_SCATTER;
+                    phase = PHASE_SCATTER;
                 }
                 if (state->ghost_chase_timer < state->ghost_chase_target_time) {
-                    state->ghost_phase = PHASE_CHASE;
+                    phase = PHASE_CHASE;
                 }
-            }
-            break;
-    }
-
-    if (IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) {
-        if (IsKeyPressed(KEY_RIGHT)) {
-            int monitor = GetCurrentMonitor();
-            int monitor_width = GetMonitorWidth(monitor);
-            int screen_width = GetScreenWidth();
-            SetWindowPosition(monitor_width - screen_width, 0);
-        }
-        if (IsKeyPressed(KEY_LEFT)) {
-            SetWindowPosition(0, 0);
-        }
-    }
-
-    if (IsKeyPressed(KEY_RIGHT)) {
-        state->player.requested_direction = DIRECTION_RIGHT;
-    } else if (IsKeyPressed(KEY_UP)) {
-        state->player.requested_direction = DIRECTION_UP;
-    } else if (IsKeyPressed(KEY_LEFT)) {
-        state->player.requested_direction = DIRECTION_LEFT;
-    } else if (IsKeyPressed(KEY_DOWN)) {
-        state->player.requested_direction = DIRECTION_DOWN;
+                set_ghost_phase(phase);
+            }
+            break;
     }
 
     {
@@ -816,72 +4198,85 @@ void update(void) {
         if (!has_flag(next_position, FLAG_WALL)) {
             switch (player->direction) {
                 case DIRECTION_RIGHT:
-                    player->fraction_position.x += SPEED_PLAYER * delta_time;
-                    player->fraction_position.y = 0.0f;
-                    if (player->fraction_position.x > 1.0f) {
+                    player->fraction_position.x += SPEED_PLAYER * ticks;
+                    player->fraction_position.y = 0;
+                    if (player->fraction_position.x >= SUBCELL_COUNT) {
+                        player->fraction_position.x -= SUBCELL_COUNT;
                         player->position.x++;
                         player_on_position_new();
                     }
                     break;
                 case DIRECTION_UP:
-                    player->fraction_position.x = 0.0f;
-                    player->fraction_position.y -= SPEED_PLAYER * delta_time;
-                    if (player->fraction_position.y < (-1.0f)) {
+                    player->fraction_position.x = 0;
+                    player->fraction_position.y -= SPEED_PLAYER * ticks;
+                    if (player->fraction_position.y <= (-SUBCELL_COUNT)) {
+                        player->fraction_position.y += SUBCELL_COUNT;
                         player->position.y--;
                         player_on_position_new();
                     }
                     break;
                 case DIRECTION_LEFT:
-                    player->fraction_position.x -= SPEED_PLAYER * delta_time;
-                    player->fraction_position.y = 0.0f;
-                    if (player->fraction_position.x < (-1.0f)) {
+                    player->fraction_position.x -= SPEED_PLAYER * ticks;
+                    player->fraction_position.y = 0;
+                    if (player->fraction_position.x <= (-SUBCELL_COUNT)) {
+                        player->fraction_position.x += SUBCELL_COUNT;
                         player->position.x--;
                         player_on_position_new();
                     }
                     break;
                 case DIRECTION_DOWN:
-                    player->fraction_position.x = 0.0f;
-                    player->fraction_position.y += SPEED_PLAYER * delta_time;
-                    if (player->fraction_position.y > 1.0f) {
+                    player->fraction_position.x = 0;
+                    player->fraction_position.y += SPEED_PLAYER * ticks;
+                    if (player->fraction_position.y >= SUBCELL_COUNT) {
+                        player->fraction_position.y -= SUBCELL_COUNT;
                         player->position.y++;
                         player_on_position_new();
                     }
                     break;
             }
         } else {
-            player->fraction_position = (Vector2){0};
+            player->fraction_position = (SubcellOffset){0};
         }
     }
 
     for (int i = 0; i < GHOST_COUNT; i++) {
         Ghost *ghost = &state->ghosts[i];
 
-        float distance = get_screen_distance(
-            get_player_screen_position(),
-            get_ghost_screen_position(ghost)
+        long long distance_squared = get_subcell_distance_squared(
+            get_player_subcell_position(),
+            get_ghost_subcell_position(ghost)
         );
 
-        if (distance < get_half_cell_size()) {
+        if (distance_squared < (long long)COLLISION_DISTANCE * COLLISION_DISTANCE) {
             switch (ghost->state) {
                 case GHOST_STATE_RETURNING:
                     break;
                 case GHOST_STATE_FRIGHTENED:
-                    ghost->state = GHOST_STATE_RETURNING;
+                    set_ghost_state(ghost, GHOST_STATE_RETURNING);
                     break;
                 default:
+                    if (!state->death_by_ghost) {
+                        log_event((GameEvent) {
+                            .type = EVENT_DEATH,
+                            .x = state->player.position.x,
+                            .y = state->player.position.y,
+                            .ghost = ghost - state->ghosts,
+                        });
+                    }
                     state->death_by_ghost = ghost;
                     break;
             }
         }
 
-        ghost->fraction_position += delta_time * get_ghost_speed(ghost);
-        if (ghost->fraction_position < 1.0f) {
+        ghost->fraction_position += ticks * get_ghost_speed(ghost);
+        if (ghost->fraction_position < SUBCELL_COUNT) {
             continue;
         }
-        ghost->fraction_position = 0.0f;
+        ghost->fraction_position -= SUBCELL_COUNT;
 
         ghost->position = get_position_in_direction(ghost->position, ghost->direction, 1);
         ghost->position = wrap_teleport(ghost->position);
+        record_visit(HEATMAP_GHOSTS + i, ghost->position);
 
         if (is_out_of_bounds(ghost->position)) {
             // do not allow changes to direction
@@ -890,39 +4285,37 @@ void update(void) {
 
         switch (ghost->state) {
             case GHOST_STATE_INSIDE: {
-                ASSERT(ghost->position.y == 10);
-                switch (ghost->position.x) {
-                    default: ASSERT(false);
-                    case 8:
-                        ghost->direction = DIRECTION_RIGHT;
-                        break;
-                    case 9:
-                        ASSERT(ghost->wait_amount >= 0);
-                        if (ghost->wait_amount > 0) {
-                            ghost->wait_amount--;
-                        } else {
-                            ghost->state = GHOST_STATE_LEAVING;
-                            ghost->direction = DIRECTION_UP;
-                        }
-                        break;
-                    case 10:
-                        ghost->direction = DIRECTION_LEFT;
-                        break;
+                ASSERT(ghost->position.y == CELL_GHOST_HOUSE_CENTER.y);
+                if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_LEFT_SIDE)) {
+                    ghost->direction = DIRECTION_RIGHT;
+                } else if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_CENTER)) {
+                    ASSERT(ghost->wait_amount >= 0);
+                    if (ghost->wait_amount > 0) {
+                        ghost->wait_amount--;
+                    } else {
+                        set_ghost_state(ghost, GHOST_STATE_LEAVING);
+                        ghost->direction = DIRECTION_UP;
+                    }
+                } else if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_RIGHT_SIDE)) {
+                    ghost->direction = DIRECTION_LEFT;
+                } else {
+                    ASSERT(false);
                 }
             } break;
             case GHOST_STATE_LEAVING: {
-                if (ghost->position.y == 10) {
-                    switch (ghost->position.x) {
-                        default: ASSERT(false);
-                        case 8: ghost->direction = DIRECTION_RIGHT; break;
-                        case 9:
-                            ghost->direction = DIRECTION_UP;
-                            break;
-                        case 10: ghost->direction = DIRECTION_LEFT; break;
+                if (ghost->position.y == CELL_GHOST_HOUSE_CENTER.y) {
+                    if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_LEFT_SIDE)) {
+                        ghost->direction = DIRECTION_RIGHT;
+                    } else if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_CENTER)) {
+                        ghost->direction = DIRECTION_UP;
+                    } else if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_RIGHT_SIDE)) {
+                        ghost->direction = DIRECTION_LEFT;
+                    } else {
+                        ASSERT(false);
                     }
-                } else if (ghost->position.y == 9) {
+                } else if (ghost->position.y == CELL_GHOST_HOUSE_DOOR.y) {
                     // keep direction
-                    ghost->state = GHOST_STATE_OUTSIDE;
+                    set_ghost_state(ghost, GHOST_STATE_OUTSIDE);
                 }
             } break;
             case GHOST_STATE_OUTSIDE: {
@@ -938,7 +4331,7 @@ void update(void) {
                 ) {
 
                     // so close that the player and the ghost are in the same cell, but not close enough for death
-                    // "get_best_direction_towards_target" returns weird results in this case
+                    // "get_shortest_direction_towards_target" returns weird results in this case
                     // so at this distance we simply take the player direction
                     // this can be exploited if someone is extremely frame-perfect good
 
@@ -952,10 +4345,10 @@ void update(void) {
                     if (direction_available) {
                         ghost->direction = state->player.direction;
                     } else {
-                        ghost->direction = get_best_direction_towards_target(&surroundings, ghost->target);
+                        ghost->direction = get_shortest_direction_towards_target(&surroundings, ghost->target);
                     }
                 } else {
-                    ghost->direction = get_best_direction_towards_target(&surroundings, ghost->target);
+                    ghost->direction = get_shortest_direction_towards_target(&surroundings, ghost->target);
                 }
                 ASSERT(ghost->direction != DIRECTION_NONE);
             } break;
@@ -963,7 +4356,7 @@ void update(void) {
                 Surroundings surroundings = {0};
                 scan_surroundings(ghost->position, ghost->direction, &surroundings);
 
-                int random_direction_idx = GetRandomValue(0, surroundings.count - 1);
+                int random_direction_idx = rng_range(&state->rng, surroundings.count);
                 ghost->direction = surroundings.directions[random_direction_idx];
                 ASSERT(ghost->direction != DIRECTION_NONE);
             } break;
@@ -974,43 +4367,616 @@ void update(void) {
                     // keep direction
                 } else if (grid_position_eq(ghost->position, CELL_GHOST_HOUSE_CENTER)) {
                     ghost->direction = DIRECTION_LEFT;
-                    ghost->state = GHOST_STATE_LEAVING;
+                    set_ghost_state(ghost, GHOST_STATE_LEAVING);
                 } else {
                     Surroundings surroundings = {0};
                     scan_surroundings(ghost->position, ghost->direction, &surroundings);
-                    ghost->direction = get_best_direction_towards_target(&surroundings, CELL_OUTSIDE_GHOST_HOUSE_DOOR);
+                    ghost->direction = get_shortest_direction_towards_target(&surroundings, CELL_OUTSIDE_GHOST_HOUSE_DOOR);
                     ASSERT(ghost->direction != DIRECTION_NONE);
                 }
             } break;
         }
     }
+}
 
-#if DEBUG
-    if (IsKeyPressed(KEY_S)) {
-        toggle_slowmotion();
+// advances the game by a whole number of ticks, there is no fractional time in the simulation
+// any amount of ticks (fast forward) gives the same game as single ticks: quiet stretches are taken in one step
+// and every tick where something can happen is taken on its own
+void update(int ticks) {
+    apply_input_events(!is_level_intro() && !state->death_by_ghost);
+
+    while (ticks > 0) {
+        int step = max_int(1, get_quiet_ticks(ticks));
+        update_step(step);
+        ticks -= step;
     }
-    if (IsKeyPressed(KEY_L)) {
-        toggle_lines();
+}
+
+void *simulation_thread(void *data) {
+    (void)data;
+    state = simulation.state;
+    set_trace_thread_name("simulation");
+
+    double next_tick = get_wall_time();
+    while (__atomic_load_n(&simulation.running, __ATOMIC_ACQUIRE)) {
+        state->assets_ready = __atomic_load_n(&simulation.assets_ready, __ATOMIC_ACQUIRE);
+        double trace_start = trace_begin();
+        perf_begin(PERF_SECTION_UPDATE);
+        update(1);
+        perf_end();
+        trace_end("update", trace_start);
+        publish_snapshot();
+        publish_tick_metrics();
+
+        next_tick += GET_SIMULATION_TICK_INTERVAL();
+        double now = get_wall_time();
+        if (now - next_tick > SIMULATION_CATCH_UP_MAX) {
+            // stalled for too long (debugger, suspended laptop), drop the backlog instead of fast forwarding
+            next_tick = now;
+        } else if (next_tick > now) {
+            WaitTime(next_tick - now);
+        }
+    }
+    return NULL;
+}
+
+// runs update() at a fixed SIMULATION_RATE, independent of how fast frames are presented
+void start_simulation(State *sim_state) {
+    simulation.state = sim_state;
+    SnapshotBuffer *buffer = &simulation.buffer;
+    buffer->back = 0;
+    buffer->middle = 1;
+    buffer->front = 2;
+
+    // the renderer must have something valid before the first tick lands
+    state = sim_state;
+    publish_snapshot();
+
+    simulation.running = 1;
+    if (pthread_create(&simulation.thread, NULL, simulation_thread, NULL) != 0) {
+        TraceLog(LOG_ERROR, "SIMULATION: Failed to start simulation thread");
+        exit(1);
+    }
+    simulation.thread_started = true;
+}
+
+void stop_simulation(void) {
+    if (simulation.thread_started) {
+        __atomic_store_n(&simulation.running, 0, __ATOMIC_RELEASE);
+        pthread_join(simulation.thread, NULL);
+        simulation.thread_started = false;
+    }
+    for (int i = 0; i < SNAPSHOT_COUNT; i++) {
+        free(simulation.buffer.snapshots[i].state.grid);
+        simulation.buffer.snapshots[i] = (Snapshot) {0};
+    }
+}
+
+typedef struct {
+    GridPosition *queue;
+    unsigned int *visited; // stamp of the search that reached the cell
+    signed char *first_direction;
+    unsigned int stamp;
+    GridPosition last_position;
+    Rng rng;
+} SelfPlay;
+
+bool self_play_init(SelfPlay *bot) {
+    *bot = (SelfPlay) {0};
+    bot->queue = malloc(state->grid_size * sizeof(GridPosition));
+    bot->visited = calloc(state->grid_size, sizeof(unsigned int));
+    bot->first_direction = malloc(state->grid_size);
+    return bot->queue && bot->visited && bot->first_direction;
+}
+
+void self_play_free(SelfPlay *bot) {
+    free(bot->queue);
+    free(bot->visited);
+    free(bot->first_direction);
+    *bot = (SelfPlay) {0};
+}
+
+static bool is_dangerous_cell(GridPosition position) {
+    for (int i = 0; i < GHOST_COUNT; i++) {
+        Ghost *ghost = &state->ghosts[i];
+        if (ghost->state != GHOST_STATE_OUTSIDE && ghost->state != GHOST_STATE_LEAVING) {
+            continue;
+        }
+        if (abs(ghost->position.x - position.x) + abs(ghost->position.y - position.y) <= 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// tunnels lead straight to the opposite border
+static GridPosition get_self_play_neighbor(GridPosition from, int direction) {
+    GridPosition position = get_position_in_direction(from, direction, 1);
+    if (position.x < 0) position.x = GRID_WIDTH - 1;
+    if (position.x >= GRID_WIDTH) position.x = 0;
+    if (position.y < 0) position.y = GRID_HEIGHT - 1;
+    if (position.y >= GRID_HEIGHT) position.y = 0;
+    return position;
+}
+
+// breadth first search to the closest dot that does not pass next to a ghost
+int get_self_play_direction(SelfPlay *bot) {
+    GridPosition from = state->player.position;
+    if (is_out_of_bounds(from)) {
+        return state->player.requested_direction;
+    }
+
+    bot->stamp++;
+    int head = 0;
+    int tail = 0;
+    bot->visited[get_grid_index(from)] = bot->stamp;
+    bot->queue[tail++] = from;
+    while (head < tail) {
+        GridPosition position = bot->queue[head++];
+        int idx = get_grid_index(position);
+        if (head > 1 && (has_flag(position, FLAG_DOT) || has_flag(position, FLAG_BIG_DOT))) {
+            return bot->first_direction[idx];
+        }
+        for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+            GridPosition next = get_self_play_neighbor(position, direction);
+            if (has_flag(next, FLAG_WALL) || is_dangerous_cell(next)) {
+                continue;
+            }
+            int next_idx = get_grid_index(next);
+            if (bot->visited[next_idx] == bot->stamp) {
+                continue;
+            }
+            bot->visited[next_idx] = bot->stamp;
+            bot->first_direction[next_idx] = (head == 1) ? direction : bot->first_direction[idx];
+            bot->queue[tail++] = next;
+        }
+    }
+
+    // boxed in, any open direction beats standing still
+    int directions[4];
+    int count = 0;
+    for (int direction = DIRECTION_RIGHT; direction <= DIRECTION_DOWN; direction++) {
+        if (!has_flag(get_self_play_neighbor(from, direction), FLAG_WALL)) {
+            directions[count++] = direction;
+        }
+    }
+    return count > 0 ? directions[rng_range(&bot->rng, count)] : DIRECTION_NONE;
+}
+
+typedef struct {
+    int idx;
+    int maze;
+    unsigned long long seed;
+} FarmJob;
+
+enum {
+    FARM_RESULT_PENDING,
+    FARM_RESULT_DONE,
+    FARM_RESULT_CRASHED,
+};
+
+// one cache line per game so workers never write to the same line
+typedef struct __attribute__((aligned(64))) {
+    int status;
+    int worker;
+    unsigned long long seed;
+    int maze;
+    int level_reached;
+    int levels_cleared;
+    int dots_eaten;
+    int ticks;
+    int steps; // calls to update(), equal to ticks unless event stepping
+    bool died;
+    float seconds;
+} FarmResult;
+
+// headless games jump from one possible event to the next instead of stepping single ticks,
+// the bot only decides when the player reaches a cell so nothing in between needs to be looked at
+bool farm_event_stepping = true;
+
+// plays one game without a window until the first death or ticks_max, the caller owns state
+void play_headless_game(const FarmJob *job, FarmResult *result, SelfPlay *bot, int ticks_max) {
+    double start = get_wall_time();
+
+    // nothing may leak from the previous game of this worker, results must only depend on the job
+    *state = (State) {
+        .grid_size = state->grid_size,
+        .grid = state->grid,
+        .mazes = state->mazes,
+        .maze_count = state->maze_count,
+    };
+    state->rng.state = job->seed;
+    bot->rng.state = job->seed ^ 0x94d049bb133111ebULL;
+    bot->last_position = (GridPosition) {-1, -1};
+    // every game starts at the first level whatever the maze so results per maze compare
+    state->maze_offset = job->maze % state->maze_count;
+    level_setup();
+    state->assets_ready = true;
+
+    result->seed = job->seed;
+    result->maze = job->maze;
+    result->levels_cleared = 0;
+    result->dots_eaten = 0;
+    result->died = false;
+    result->steps = 0;
+
+    int tick = 0;
+    while (tick < ticks_max) {
+        Player *player = &state->player;
+        if (!is_level_intro() && (!grid_position_eq(player->position, bot->last_position) || player->direction == DIRECTION_NONE)) {
+            player->requested_direction = get_self_play_direction(bot);
+            bot->last_position = player->position;
+        }
+
+        // the quiet ticks and the one after them, where the next cell, timer or collision can happen
+        // a standing player asks the bot every tick so it is stepped singly
+        int step = 1;
+        if (farm_event_stepping && player->direction != DIRECTION_NONE) {
+            step = min_int(ticks_max - tick, get_quiet_ticks(ticks_max - tick) + 1);
+        }
+
+        int level_idx = state->level_idx;
+        int dot_count = state->dot_count;
+        update(step);
+        result->steps++;
+        if (state->level_idx != level_idx) {
+            result->levels_cleared++;
+            result->dots_eaten += dot_count;
+        } else {
+            result->dots_eaten += dot_count - state->dot_count;
+        }
+        if (state->death_by_ghost) {
+            // the player dies on the last tick of a step, and like single stepping that tick is not counted
+            tick += step - 1;
+            result->died = true;
+            break;
+        }
+        tick += step;
+    }
+
+    result->level_reached = state->level_idx;
+    result->ticks = tick;
+    result->seconds = (float)(get_wall_time() - start);
+}
+
+#if !defined(_WIN32)
+typedef struct {
+    // ring of jobs, the coordinator produces and every worker consumes
+    unsigned int head;
+    unsigned int tail;
+    int closed;
+    FarmJob jobs[FARM_QUEUE_SIZE];
+
+    int worker_jobs[FARM_WORKERS_MAX]; // game each worker is playing right now, -1 when idle
+    unsigned int *heatmaps; // separate shared mapping, every maze's layers back to back, NULL when not recorded
+    FarmResult results[];
+} FarmShared;
+
+static bool pop_farm_job(FarmShared *shared, FarmJob *job) {
+    for (;;) {
+        unsigned int head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+        unsigned int tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (__atomic_load_n(&shared->closed, __ATOMIC_ACQUIRE) && head == __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE)) {
+                return false;
+            }
+            WaitTime(0.001);
+            continue;
+        }
+        // the slot can not be reused before head moves past it
+        *job = shared->jobs[head & (FARM_QUEUE_SIZE - 1)];
+        if (__atomic_compare_exchange_n(&shared->head, &head, head + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+}
+
+static size_t get_farm_heatmap_cells(void) {
+    size_t cells = 0;
+    for (int i = 0; i < state->maze_count; i++) {
+        cells += (size_t)state->mazes[i].header->width * state->mazes[i].header->height * HEATMAP_ACTOR_COUNT;
+    }
+    return cells;
+}
+
+// after every game, so a crash only loses the visits of the game it happened in
+static void merge_farm_heatmaps(unsigned int *totals) {
+    size_t offset = 0;
+    for (int i = 0; i < state->maze_count; i++) {
+        Heatmap *heatmap = &state->mazes[i].heatmap;
+        size_t cells = (size_t)state->mazes[i].header->width * state->mazes[i].header->height * HEATMAP_ACTOR_COUNT;
+        if (heatmap->visits != NULL) {
+            for (size_t j = 0; j < cells; j++) {
+                if (heatmap->visits[j]) {
+                    __atomic_fetch_add(&totals[offset + j], heatmap->visits[j], __ATOMIC_RELAXED);
+                }
+            }
+            heatmap_clear(heatmap);
+        }
+        offset += cells;
+    }
+}
+
+static void farm_worker(FarmShared *shared, int worker, int ticks_max) {
+    SelfPlay bot;
+    if (!self_play_init(&bot)) {
+        _exit(1);
+    }
+    FarmJob job;
+    while (pop_farm_job(shared, &job)) {
+        FarmResult *result = &shared->results[job.idx];
+        result->worker = worker;
+        result->seed = job.seed;
+        result->maze = job.maze;
+        __atomic_store_n(&shared->worker_jobs[worker], job.idx, __ATOMIC_RELEASE);
+        play_headless_game(&job, result, &bot, ticks_max);
+        if (shared->heatmaps) {
+            merge_farm_heatmaps(shared->heatmaps);
+        }
+        __atomic_store_n(&result->status, FARM_RESULT_DONE, __ATOMIC_RELEASE);
+        __atomic_store_n(&shared->worker_jobs[worker], -1, __ATOMIC_RELEASE);
+    }
+    self_play_free(&bot);
+    _exit(0);
+}
+
+static pid_t spawn_farm_worker(FarmShared *shared, int worker, int ticks_max) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        farm_worker(shared, worker, ticks_max);
+    }
+    if (pid < 0) {
+        TraceLog(LOG_ERROR, "FARM: Failed to fork worker %i", worker);
+    }
+    return pid;
+}
+
+static bool save_farm_results(const char *file_name, const FarmResult *results, int count) {
+    FILE *file = fopen(file_name, "w");
+    if (file == NULL) {
+        TraceLog(LOG_ERROR, "FARM: [%s] Failed to open results file", file_name);
+        return false;
+    }
+    fprintf(file, "game,status,worker,seed,maze,level_reached,levels_cleared,dots_eaten,ticks,died,seconds,steps\n");
+    for (int i = 0; i < count; i++) {
+        const FarmResult *r = &results[i];
+        fprintf(
+            file, "%i,%i,%i,%llu,%i,%i,%i,%i,%i,%i,%.6f,%i\n",
+            i, r->status, r->worker, r->seed, r->maze, r->level_reached, r->levels_cleared, r->dots_eaten, r->ticks, r->died, r->seconds, r->steps
+        );
+    }
+    fclose(file);
+    return true;
+}
+#endif
+
+// self-play on worker processes, a worker that dies takes only its current game with it and gets replaced
+int run_farm(int games, unsigned long long seed, int worker_count, int ticks_max, const char *results_file, const char *heatmap_file) {
+#if defined(_WIN32)
+    (void)games; (void)seed; (void)worker_count; (void)ticks_max; (void)results_file; (void)heatmap_file;
+    TraceLog(LOG_ERROR, "FARM: Worker processes are not supported on this platform");
+    return 1;
+#else
+    if (worker_count <= 0) {
+        worker_count = get_default_thread_count();
+    }
+    if (worker_count > FARM_WORKERS_MAX) {
+        worker_count = FARM_WORKERS_MAX;
+    }
+
+    size_t shared_size = sizeof(FarmShared) + ((size_t)games * sizeof(FarmResult));
+    FarmShared *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        TraceLog(LOG_ERROR, "FARM: Failed to map %zu bytes of shared memory", shared_size);
+        return 1;
+    }
+    for (int i = 0; i < FARM_WORKERS_MAX; i++) {
+        shared->worker_jobs[i] = -1;
+    }
+    size_t heatmap_size = get_farm_heatmap_cells() * sizeof(unsigned int);
+    if (heatmap_file) {
+        shared->heatmaps = mmap(NULL, heatmap_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared->heatmaps == MAP_FAILED) {
+            TraceLog(LOG_ERROR, "FARM: Failed to map %zu bytes of shared memory for heatmaps", heatmap_size);
+            munmap(shared, shared_size);
+            return 1;
+        }
+    }
+
+    double start = get_wall_time();
+    pid_t pids[FARM_WORKERS_MAX] = {0};
+    int running = 0;
+    for (int i = 0; i < worker_count; i++) {
+        pids[i] = spawn_farm_worker(shared, i, ticks_max);
+        running += pids[i] > 0;
+    }
+
+    Rng rng = { seed };
+    int pushed = 0;
+    while (running > 0) {
+        while (pushed < games && shared->tail - __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE) < FARM_QUEUE_SIZE) {
+            shared->jobs[shared->tail & (FARM_QUEUE_SIZE - 1)] = (FarmJob) {
+                .idx = pushed,
+                .maze = pushed % state->maze_count,
+                .seed = rng_next(&rng),
+            };
+            __atomic_store_n(&shared->tail, shared->tail + 1, __ATOMIC_RELEASE);
+            pushed++;
+        }
+        if (pushed == games) {
+            __atomic_store_n(&shared->closed, 1, __ATOMIC_RELEASE);
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            int worker = 0;
+            while (worker < worker_count && pids[worker] != pid) {
+                worker++;
+            }
+            if (worker == worker_count) {
+                continue;
+            }
+            pids[worker] = 0;
+            running--;
+
+            int job = __atomic_load_n(&shared->worker_jobs[worker], __ATOMIC_ACQUIRE);
+            if (job >= 0) {
+                shared->results[job].status = FARM_RESULT_CRASHED;
+                shared->worker_jobs[worker] = -1;
+                TraceLog(LOG_WARNING, "FARM: Worker %i died during game %i (seed %llu), replacing it", worker, job, shared->results[job].seed);
+            }
+            bool clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (!clean) {
+                pids[worker] = spawn_farm_worker(shared, worker, ticks_max);
+                running += pids[worker] > 0;
+            }
+        }
+
+        WaitTime(0.001);
+    }
+    double seconds = get_wall_time() - start;
+
+    long long dots = 0;
+    long long levels = 0;
+    long long ticks = 0;
+    long long steps = 0;
+    int deaths = 0;
+    int done = 0;
+    int crashed = 0;
+    for (int i = 0; i < games; i++) {
+        FarmResult *r = &shared->results[i];
+        if (r->status != FARM_RESULT_DONE) {
+            // also covers a worker that died between taking a game and announcing it
+            r->status = FARM_RESULT_CRASHED;
+            crashed++;
+            continue;
+        }
+        done++;
+        dots += r->dots_eaten;
+        levels += r->levels_cleared;
+        deaths += r->died;
+        ticks += r->ticks;
+        steps += r->steps;
+    }
+    TraceLog(
+        LOG_INFO,
+        "FARM: %i games in %.3fs (%.0f/s) on %i workers, %i crashed, %i died, %.1f dots and %.2f levels per game, %.1f ticks per step",
+        done, seconds, done / (seconds > 0 ? seconds : 1), worker_count, crashed, deaths,
+        done ? (double)dots / done : 0.0, done ? (double)levels / done : 0.0, steps ? (double)ticks / steps : 0.0
+    );
+
+    bool saved = true;
+    if (results_file) {
+        saved = save_farm_results(results_file, shared->results, games);
     }
+    if (shared->heatmaps) {
+        load_heatmaps(heatmap_file);
+        size_t offset = 0;
+        for (int i = 0; i < state->maze_count; i++) {
+            Maze *maze = &state->mazes[i];
+            if (heatmap_alloc(maze)) {
+                heatmap_add(&maze->heatmap, &shared->heatmaps[offset]);
+            }
+            offset += (size_t)maze->header->width * maze->header->height * HEATMAP_ACTOR_COUNT;
+        }
+        saved = save_heatmaps(heatmap_file) && saved;
+        munmap(shared->heatmaps, heatmap_size);
+    }
+    munmap(shared, shared_size);
+    return (saved && crashed == 0) ? 0 : 1;
 #endif
+}
+
+enum {
+    RENDER_COMMAND_RECTANGLE,
+    RENDER_COMMAND_CIRCLE,
+};
+
+typedef struct {
+    int type;
+    Rectangle rec; // circles use x and y as center and width as radius
+    Color color;
+} RenderCommand;
+
+// the CPU side of a frame, filled in parallel by jobs and then drawn in order by the main thread
+typedef struct {
+    RenderCommand *commands;
+    int *command_counts;
+    size_t command_capacity;
+    int column_capacity;
+
+    int x_start;
+    int y_start;
+    int columns;
+    int rows;
+    float thickness;
+
+    Color noise[NOISE_AMOUNT * NOISE_AMOUNT];
+    unsigned long long noise_seed;
+    Rng noise_rng;
+} RenderPrep;
+
+RenderPrep render_prep;
+
+bool reserve_render_commands(RenderPrep *prep) {
+    size_t needed = (size_t)prep->columns * prep->rows * RENDER_COMMANDS_PER_CELL;
+    if (needed > prep->command_capacity) {
+        RenderCommand *commands = realloc(prep->commands, needed * sizeof(RenderCommand));
+        if (commands == NULL) {
+            TraceLog(LOG_ERROR, "RENDER: Failed to allocate %zu render commands", needed);
+            return false;
+        }
+        prep->commands = commands;
+        prep->command_capacity = needed;
+    }
+    if (prep->columns > prep->column_capacity) {
+        int *counts = realloc(prep->command_counts, prep->columns * sizeof(int));
+        if (counts == NULL) {
+            TraceLog(LOG_ERROR, "RENDER: Failed to allocate %i render columns", prep->columns);
+            return false;
+        }
+        prep->command_counts = counts;
+        prep->column_capacity = prep->columns;
+    }
+    return true;
+}
+
+void free_render_prep(void) {
+    free(render_prep.commands);
+    free(render_prep.command_counts);
+    render_prep.commands = NULL;
+    render_prep.command_counts = NULL;
+    render_prep.command_capacity = 0;
+    render_prep.column_capacity = 0;
+}
 
-    float level_width = get_cell_size() * GRID_WIDTH;
-    state->render_x_offset = (GetScreenWidth() - level_width) / 2;
+// one job per column, every column has its own sequence so the result does not depend on scheduling
+void prepare_noise_column(void *data, int idx) {
+    RenderPrep *prep = data;
+    Rng rng = { prep->noise_seed ^ ((unsigned long long)idx * 0xd1b54a32d192ed03ULL) };
+    for (int y = 0; y < NOISE_AMOUNT; y++) {
+        unsigned char p = rng_range(&rng, 2) * 127;
+        prep->noise[(idx * NOISE_AMOUNT) + y] = (Color){p,p,p,255};
+    }
 }
 
 void render_noise(const char *text) {
-    int amount = 100;
-    float w = GetScreenWidth() / (float)amount;
-    float h = GetScreenHeight() / (float)amount;
-    for (int x = 0; x < amount; x++) {
-        for (int y = 0; y < amount; y++) {
-            int p = GetRandomValue(0, 1) * 127;
+    RenderPrep *prep = &render_prep;
+    prep->noise_seed = rng_next(&prep->noise_rng);
+    run_parallel(prepare_noise_column, prep, NOISE_AMOUNT);
+
+    float w = GetScreenWidth() / (float)NOISE_AMOUNT;
+    float h = GetScreenHeight() / (float)NOISE_AMOUNT;
+    for (int x = 0; x < NOISE_AMOUNT; x++) {
+        for (int y = 0; y < NOISE_AMOUNT; y++) {
             Rectangle rec;
             rec.x = x * w;
             rec.y = y * h;
             rec.width = w;
             rec.height = h;
-            DrawRectangleRec(rec, (Color){p,p,p,255});
+            DrawRectangleRec(rec, prep->noise[(x * NOISE_AMOUNT) + y]);
         }
     }
 
@@ -1159,20 +5125,11 @@ void render_ghost(Ghost *ghost) {
     Vector2 center = get_ghost_screen_position(ghost);
 
     float scale = (get_cell_size() / (float)PNG_DIMENSIONS);
+    int sprite_size = SPRITE_SIZE_CELL;
 
     if (ghost == &state->ghosts[0]) {
         scale *= 1.5f;
-    }
-
-    Rectangle src;
-    src.x = 0;
-    src.y = 0;
-    src.width = PNG_DIMENSIONS;
-    src.height = PNG_DIMENSIONS;
-
-    if (ghost->direction == DIRECTION_LEFT) {
-        src.x = PNG_DIMENSIONS;
-        src.width = -PNG_DIMENSIONS;
+        sprite_size = SPRITE_SIZE_BLINKY;
     }
 
     Rectangle dst;
@@ -1185,9 +5142,9 @@ void render_ghost(Ghost *ghost) {
     origin.x = dst.width / 2;
     origin.y = dst.height / 2;
 
-    float rotation;
+    float rotation = 0;
     Color color = { 255, 255, 255, 255 };
-    Texture texture;
+    int asset;
 
     switch (ghost->direction) {
         case DIRECTION_RIGHT:
@@ -1199,35 +5156,74 @@ void render_ghost(Ghost *ghost) {
 
     switch (ghost->state) {
         default:
-            texture = ghost->texture;
+            asset = get_ghost_asset(ghost);
             break;
         case GHOST_STATE_FRIGHTENED: {
             float flicker_speed = 0.0f;
-            if ((state->ghost_frightened_timer + 1) > state->ghost_frightened_target_time) {
+            if ((state->ghost_frightened_timer + SECONDS_TO_TICKS(1)) > state->ghost_frightened_target_time) {
                 flicker_speed = 0.05f;
-            } else if ((state->ghost_frightened_timer + 3) > state->ghost_frightened_target_time) {
+            } else if ((state->ghost_frightened_timer + SECONDS_TO_TICKS(3)) > state->ghost_frightened_target_time) {
                 flicker_speed = 0.1f;
             }
 
             if (flicker_speed) {
-                float x = state->ghost_frightened_target_time - state->ghost_frightened_timer;
+                float x = TICKS_TO_SECONDS(state->ghost_frightened_target_time - state->ghost_frightened_timer);
                 if ((int)floorf(x / flicker_speed) % 2 == 0) {
-                    texture = state->ghost_frightened_texture;
+                    asset = ASSET_FRIGHTENED;
                 } else {
-                    texture = ghost->texture;
+                    asset = get_ghost_asset(ghost);
                 }
             } else {
-                texture = state->ghost_frightened_texture;
+                asset = ASSET_FRIGHTENED;
             }
         } break;
         case GHOST_STATE_RETURNING:
-            texture = state->ghost_returning_texture;
+            asset = ASSET_RETURNING;
             break;
     }
 
+    Texture texture = get_sprite(asset, sprite_size);
+
+    Rectangle src;
+    src.x = 0;
+    src.y = 0;
+    src.width = texture.width;
+    src.height = texture.height;
+
+    if (ghost->direction == DIRECTION_LEFT) {
+        src.x = texture.width;
+        src.width = -texture.width;
+    }
+
     DrawTexturePro(texture, src, dst, origin, rotation, color);
 }
 
+void render_heatmap_overlay(int x_start, int y_start, int x_end, int y_end) {
+    const Heatmap *heatmap = state->heatmap;
+    if (heatmap_overlay < 0 || heatmap == NULL) {
+        return;
+    }
+    unsigned int max = __atomic_load_n(&heatmap->max[heatmap_overlay], __ATOMIC_RELAXED);
+    if (max == 0) {
+        return;
+    }
+
+    Color color = (heatmap_overlay == HEATMAP_PLAYER) ? COLOR_PLAYER : state->ghosts[heatmap_overlay - HEATMAP_GHOSTS].color;
+    const unsigned int *layer = get_heatmap_layer(heatmap, heatmap_overlay);
+    for (int y = y_start; y < y_end; y++) {
+        for (int x = x_start; x < x_end; x++) {
+            unsigned int count = __atomic_load_n(&layer[(y * heatmap->width) + x], __ATOMIC_RELAXED);
+            if (count == 0) {
+                continue;
+            }
+            // square root so cells that were passed a few times still show up next to the hot spots
+            color.a = (unsigned char)(200.0f * sqrtf((float)count / (float)max));
+            Vector2 s = to_screen((GridPosition){x,y});
+            DrawRectangleV(s, (Vector2){ get_cell_size(), get_cell_size() }, color);
+        }
+    }
+}
+
 Color blend_influences(Vector2 position, Color base_color) {
     float r = base_color.r * 0.5f; // base color is dim
     float g = base_color.g * 0.5f;
@@ -1295,95 +5291,152 @@ Color hsv(float t) {
     };
 }
 
+// one job per visible column, the commands come out in the same order the cells used to be drawn in
+void prepare_column(void *data, int idx) {
+    RenderPrep *prep = data;
+    RenderCommand *commands = &prep->commands[(size_t)idx * prep->rows * RENDER_COMMANDS_PER_CELL];
+    int count = 0;
+    int x = prep->x_start + idx;
+    float thickness = prep->thickness;
+
+    float sin_offset = sinf((TICKS_TO_SECONDS(state->global_sine_timer) * PI * 2) + x) * get_eighth_cell_size();
+    Color column_color = hsv((float)x/GRID_WIDTH);
+    for (int y = prep->y_start; y < prep->y_start + prep->rows; y++) {
+        float cos_offset = cosf((TICKS_TO_SECONDS(state->global_sine_timer) * PI * 2) + y) * get_eighth_cell_size();
+        GridPosition cell = {x,y};
+        bool is_wall = has_flag(cell, FLAG_WALL);
+        if (grid_position_eq(cell, CELL_GHOST_HOUSE_DOOR)) {
+            // colored like floor but it is really a wall
+        } else if (is_wall) {
+            Vector2 s = to_screen(cell);
+            Color wall_color = blend_influences(s, COLOR_WALL);
+
+            if (!has_flag(cell, FLAG_WALL_TO_RIGHT)) {
+                Rectangle rec = {
+                    s.x + get_cell_size() - thickness,
+                    s.y + thickness,
+                    thickness,
+                    get_cell_size() - (thickness * 2),
+                };
+                commands[count++] = (RenderCommand) { RENDER_COMMAND_RECTANGLE, rec, wall_color };
+            }
+            if (!has_flag(cell, FLAG_WALL_ABOVE)) {
+                Rectangle rec = {
+                    s.x + thickness,
+                    s.y,
+                    get_cell_size() - (thickness * 2),
+                    thickness,
+                };
+                commands[count++] = (RenderCommand) { RENDER_COMMAND_RECTANGLE, rec, wall_color };
+            }
+            if (!has_flag(cell, FLAG_WALL_TO_LEFT)) {
+                Rectangle rec = {
+                    s.x,
+                    s.y + thickness,
+                    thickness,
+                    get_cell_size() - (thickness * 2),
+                };
+                commands[count++] = (RenderCommand) { RENDER_COMMAND_RECTANGLE, rec, wall_color };
+            }
+            if (!has_flag(cell, FLAG_WALL_BELOW)) {
+                Rectangle rec = {
+                    s.x + thickness,
+                    s.y + get_cell_size() - thickness,
+                    get_cell_size() - (thickness * 2),
+                    thickness,
+                };
+                commands[count++] = (RenderCommand) { RENDER_COMMAND_RECTANGLE, rec, wall_color };
+            }
+        }
+        if (!is_wall) {
+            if (has_flag(cell, FLAG_DOT)) {
+                const float dot_radius = get_cell_size() / 10;
+                commands[count++] = (RenderCommand) {
+                    RENDER_COMMAND_CIRCLE,
+                    {
+                        state->render_offset.x + (x * get_cell_size()) + get_half_cell_size() + sin_offset,
+                        state->render_offset.y + (y * get_cell_size()) + get_half_cell_size() + cos_offset,
+                        dot_radius,
+                        0,
+                    },
+                    column_color,
+                };
+            } else if (has_flag(cell, FLAG_BIG_DOT)) {
+                const float dot_radius = get_cell_size() / 4;
+                commands[count++] = (RenderCommand) {
+                    RENDER_COMMAND_CIRCLE,
+                    {
+                        state->render_offset.x + (x * get_cell_size()) + get_half_cell_size() + sin_offset,
+                        state->render_offset.y + (y * get_cell_size()) + get_half_cell_size() + cos_offset,
+                        dot_radius,
+                        0,
+                    },
+                    column_color,
+                };
+            }
+        }
+    }
+
+    prep->command_counts[idx] = count;
+}
+
 void render(void) {
-    if (state->level_intro < LEVEL_INTRO_LENGTH) {
+    if (is_level_intro()) {
         const char *text = TextFormat("LEVEL %i", state->level_idx);
         render_noise(text);
-        state->level_intro += GetFrameTime();
         return;
     }
 
+    update_sprite_cache();
+
     float thickness_multiplier = get_eighth_cell_size();
     float thickness = thickness_multiplier + (thickness_multiplier + (state->global_sine * thickness_multiplier * 0.9f));
 
+    // only the cells on screen are visited so big mazes cost as much as the window shows
+    int x_start = (int)floorf(-state->render_offset.x / get_cell_size());
+    int y_start = (int)floorf(-state->render_offset.y / get_cell_size());
+    int x_end = (int)ceilf((GetScreenWidth() - state->render_offset.x) / get_cell_size());
+    int y_end = (int)ceilf((GetScreenHeight() - state->render_offset.y) / get_cell_size());
+    if (x_start < 0) x_start = 0;
+    if (y_start < 0) y_start = 0;
+    if (x_end > GRID_WIDTH) x_end = GRID_WIDTH;
+    if (y_end > GRID_HEIGHT) y_end = GRID_HEIGHT;
+
     ClearBackground(COLOR_FLOOR);
-    for (int x = 0; x < GRID_WIDTH; x++) {
-        float sin_offset = sinf((state->global_sine_timer * PI * 2) + x) * get_eighth_cell_size();
-        Color column_color = hsv((float)x/GRID_WIDTH);
-        for (int y = 0; y < GRID_HEIGHT; y++) {
-            float cos_offset = cosf((state->global_sine_timer * PI * 2) + y) * get_eighth_cell_size();
-            GridPosition cell = {x,y};
-            bool is_wall = has_flag(cell, FLAG_WALL);
-            Color wall_color = blend_influences(to_screen((GridPosition){x,y}), COLOR_WALL);
-            if (x == 9 && y == 9) {
-                // colored like floor but it is really a wall
-            } else if (is_wall) {
-                Vector2 s = to_screen(cell);
-
-                if (!has_flag(cell, FLAG_WALL_TO_RIGHT)) {
-                    Rectangle rec = {
-                        s.x + get_cell_size() - thickness,
-                        s.y + thickness,
-                        thickness,
-                        get_cell_size() - (thickness * 2),
-                    };
-                    DrawRectangleRec(rec, wall_color);
-                }
-                if (!has_flag(cell, FLAG_WALL_ABOVE)) {
-                    Rectangle rec = {
-                        s.x + thickness,
-                        s.y,
-                        get_cell_size() - (thickness * 2),
-                        thickness,
-                    };
-                    DrawRectangleRec(rec, wall_color);
-                }
-                if (!has_flag(cell, FLAG_WALL_TO_LEFT)) {
-                    Rectangle rec = {
-                        s.x,
-                        s.y + thickness,
-                        thickness,
-                        get_cell_size() - (thickness * 2),
-                    };
-                    DrawRectangleRec(rec, wall_color);
-                }
-                if (!has_flag(cell, FLAG_WALL_BELOW)) {
-                    Rectangle rec = {
-                        s.x + thickness,
-                        s.y + get_cell_size() - thickness,
-                        get_cell_size() - (thickness * 2),
-                        thickness,
-                    };
-                    DrawRectangleRec(rec, wall_color);
-                }
-            }
-            if (!is_wall) {
-                if (has_flag(cell, FLAG_DOT)) {
-                    const float dot_radius = get_cell_size() / 10;
-                    DrawCircle(
-                        state->render_x_offset + (x * get_cell_size()) + get_half_cell_size() + sin_offset,
-                        (y * get_cell_size()) + get_half_cell_size() + cos_offset,
-                        dot_radius,
-                        column_color
-                    );
-                } else if (has_flag(cell, FLAG_BIG_DOT)) {
-                    const float dot_radius = get_cell_size() / 4;
-                    DrawCircle(
-                        state->render_x_offset + (x * get_cell_size()) + get_half_cell_size() + sin_offset,
-                        (y * get_cell_size()) + get_half_cell_size() + cos_offset,
-                        dot_radius,
-                        column_color
-                    );
+
+    RenderPrep *prep = &render_prep;
+    prep->x_start = x_start;
+    prep->y_start = y_start;
+    prep->columns = x_end > x_start ? x_end - x_start : 0;
+    prep->rows = y_end > y_start ? y_end - y_start : 0;
+    prep->thickness = thickness;
+    if (reserve_render_commands(prep)) {
+        double trace_start = trace_begin();
+        perf_begin(PERF_SECTION_RENDER_GRID);
+        run_parallel(prepare_column, prep, prep->columns);
+        for (int column = 0; column < prep->columns; column++) {
+            RenderCommand *commands = &prep->commands[(size_t)column * prep->rows * RENDER_COMMANDS_PER_CELL];
+            for (int i = 0; i < prep->command_counts[column]; i++) {
+                RenderCommand *command = &commands[i];
+                switch (command->type) {
+                    case RENDER_COMMAND_RECTANGLE:
+                        DrawRectangleRec(command->rec, command->color);
+                        break;
+                    case RENDER_COMMAND_CIRCLE:
+                        DrawCircle(command->rec.x, command->rec.y, command->rec.width, command->color);
+                        break;
                 }
             }
         }
+        perf_end();
+        trace_end("render grid", trace_start);
     }
 
+    render_heatmap_overlay(x_start, y_start, x_end, y_end);
+
     {
-        Vector2 line_start = {
-            state->render_x_offset + 9 * get_cell_size(),
-            (9 * get_cell_size()) + get_half_cell_size()
-        };
+        Vector2 line_start = to_screen(CELL_GHOST_HOUSE_DOOR);
+        line_start.y += get_half_cell_size();
 
         Vector2 line_end = {
             line_start.x + get_cell_size(),
@@ -1401,8 +5454,7 @@ void render(void) {
     render_player();
 
     if (state->death_by_ghost) {
-        static float death_timer = 0.0f;
-        death_timer += GetFrameTime();
+        float death_timer = TICKS_TO_SECONDS(state->death_timer);
 
         if (death_timer < 1) {
             float the_bigger_side = (GetScreenWidth() < GetScreenHeight()) ? GetScreenHeight() : GetScreenWidth();
@@ -1430,7 +5482,7 @@ void render(void) {
             origin.x = dst.width / 2;
             origin.y = dst.height / 2;
 
-            float rotation;
+            float rotation = 0;
             Color color = { 255, 255, 255, 255 };
             switch (state->death_by_ghost->state) {
                 default:
@@ -1443,20 +5495,16 @@ void render(void) {
                     }
                     break;
                 case GHOST_STATE_FRIGHTENED:
-                    rotation = state->global_sine_timer * 360.0f;
+                    rotation = TICKS_TO_SECONDS(state->global_sine_timer) * 360.0f;
                     color.a = 128;
                     break;
                 case GHOST_STATE_RETURNING:
-                    rotation = state->global_sine_timer * 360.0f * 4;
+                    rotation = TICKS_TO_SECONDS(state->global_sine_timer) * 360.0f * 4;
                     color.a = 64;
                     break;
             }
 
-            DrawTexturePro(state->death_by_ghost->texture, src, dst, origin, rotation, color);
-        } else {
-            death_timer = 0;
-            state->level_idx = 0;
-            level_setup();
+            DrawTexturePro(assets.assets[get_ghost_asset(state->death_by_ghost)].texture, src, dst, origin, rotation, color);
         }
     }
 
@@ -1469,21 +5517,184 @@ void render(void) {
 #endif
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    double start_time = get_wall_time();
+    trace.start_time = start_time;
+    set_trace_thread_name("main");
+    const char *levels_directory = NULL;
+    int farm_games = 0;
+    unsigned long long farm_seed = 0;
+    int farm_workers = 0;
+    int farm_ticks = FARM_TICKS_MAX;
+    const char *farm_results = NULL;
+    const char *heatmap_file = NULL;
+    const char *event_log_file = NULL;
+    bool metrics_enabled = false;
+    const char *perf_counters_file = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (TextIsEqual(argv[i], "--levels") && (i + 1) < argc) {
+            levels_directory = argv[++i];
+        } else if (TextIsEqual(argv[i], "--generate") && (i + 3) < argc) {
+            const char *directory = argv[i + 1];
+            int count = TextToInteger(argv[i + 2]);
+            unsigned long long seed = strtoull(argv[i + 3], NULL, 10);
+            int width = BUILTIN_MAZE_WIDTH;
+            int height = BUILTIN_MAZE_HEIGHT;
+            int thread_count = 0;
+            for (int j = i + 4; j < argc; j++) {
+                if (TextIsEqual(argv[j], "--threads") && (j + 1) < argc) {
+                    thread_count = TextToInteger(argv[++j]);
+                } else if (TextIsEqual(argv[j], "--size") && (j + 2) < argc) {
+                    width = TextToInteger(argv[++j]);
+                    height = TextToInteger(argv[++j]);
+                }
+            }
+            if (width > GRID_SIZE_MAX || height > GRID_SIZE_MAX) {
+                TraceLog(LOG_WARNING, "GENERATOR: Cannot generate %ix%i mazes, at most %ix%i is supported", width, height, GRID_SIZE_MAX, GRID_SIZE_MAX);
+                return 1;
+            }
+            return generate_mazes(directory, count, seed, width, height, thread_count) == count ? 0 : 1;
+        } else if (TextIsEqual(argv[i], "--farm") && (i + 2) < argc) {
+            farm_games = TextToInteger(argv[++i]);
+            farm_seed = strtoull(argv[++i], NULL, 10);
+        } else if (TextIsEqual(argv[i], "--workers") && (i + 1) < argc) {
+            farm_workers = TextToInteger(argv[++i]);
+        } else if (TextIsEqual(argv[i], "--ticks") && (i + 1) < argc) {
+            farm_ticks = TextToInteger(argv[++i]);
+        } else if (TextIsEqual(argv[i], "--tick-stepping")) {
+            farm_event_stepping = false;
+        } else if (TextIsEqual(argv[i], "--results") && (i + 1) < argc) {
+            farm_results = argv[++i];
+        } else if (TextIsEqual(argv[i], "--event-log") && (i + 1) < argc) {
+            event_log_file = argv[++i];
+        } else if (TextIsEqual(argv[i], "--metrics")) {
+            metrics_enabled = true;
+        } else if (TextIsEqual(argv[i], "--watch-metrics")) {
+            return watch_metrics(METRICS_SHM_NAME);
+        } else if (TextIsEqual(argv[i], "--perf-counters") && (i + 1) < argc) {
+            perf_counters_file = argv[++i];
+        } else if (TextIsEqual(argv[i], "--trace") && (i + 1) < argc) {
+            trace.file_name = argv[++i];
+            start_trace();
+        } else if (TextIsEqual(argv[i], "--heatmaps") && (i + 1) < argc) {
+            heatmap_file = argv[++i];
+        } else if (TextIsEqual(argv[i], "--measure-startup")) {
+            startup_profile.enabled = true;
+        } else if (TextIsEqual(argv[i], "--export-level") && (i + 1) < argc) {
+            Maze maze;
+            if (!maze_create_builtin(&maze)) {
+                return 1;
+            }
+            bool saved = maze_save(&maze, argv[++i]);
+            maze_unload(&maze);
+            return saved ? 0 : 1;
+        }
+    }
+
+    if (farm_games > 0) {
+        if (event_log_file) {
+            // workers are separate processes playing many games, there is no single game to log
+            TraceLog(LOG_ERROR, "FARM: --event-log can not be combined with --farm");
+            return 1;
+        }
+        record_heatmaps = heatmap_file != NULL;
+        state = (State *)calloc(sizeof(State), 1);
+        if (levels_directory) {
+            load_mazes(levels_directory);
+        }
+        init();
+        int result = run_farm(farm_games, farm_seed, farm_workers, farm_ticks, farm_results, heatmap_file);
+        unload_mazes();
+        free(state->grid);
+        free(state);
+        return result;
+    }
+
+    bool first_frame = true;
+    unsigned long long frame = 0;
+    mark_startup_phase_at("main", NULL, start_time);
+
+    state = (State *)calloc(sizeof(State), 1);
+    mark_startup_phase("calloc State", NULL);
+    start_asset_loading();
+
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
-    InitWindow(40 * GRID_WIDTH, 40 * GRID_HEIGHT, "Mats Pac");
-    SetWindowMinSize(GRID_WIDTH * 10, GRID_HEIGHT * 10);
+    InitWindow(40 * BUILTIN_MAZE_WIDTH, 40 * BUILTIN_MAZE_HEIGHT, "Mats Pac");
+    mark_startup_phase("InitWindow", NULL);
+    SetWindowMinSize(BUILTIN_MAZE_WIDTH * 10, BUILTIN_MAZE_HEIGHT * 10);
     SetTargetFPS(60);
-    state = (State *)calloc(sizeof(State), 1);
+    if (levels_directory) {
+        load_mazes(levels_directory);
+        mark_startup_phase("load_mazes", levels_directory);
+    }
+    if (event_log_file) {
+        start_event_log(event_log_file);
+    }
+    if (metrics_enabled) {
+        start_metrics(METRICS_SHM_NAME);
+    }
+    if (perf_counters_file) {
+        start_perf_counters(perf_counters_file);
+    }
+    record_heatmaps = true;
     init();
+    if (heatmap_file) {
+        load_heatmaps(heatmap_file);
+    }
+
+    // the main thread takes part in every batch, the simulation thread mostly sleeps
+    start_jobs(get_default_thread_count() - 1);
+    render_prep.noise_rng.state = (unsigned long long)(start_time * 1e9);
+
+    State *sim_state = state;
+    start_simulation(sim_state);
     while (!WindowShouldClose()) {
-        update();
+        bool assets_ready = upload_assets();
+        __atomic_store_n(&simulation.assets_ready, assets_ready, __ATOMIC_RELEASE);
+        handle_input();
+        state = acquire_snapshot();
+        update_camera();
+        double trace_start = trace_begin();
         BeginDrawing();
         render();
+        trace_end("render", trace_start);
+        trace_start = trace_begin();
+        perf_begin(PERF_SECTION_END_DRAWING);
         EndDrawing();
+        perf_end();
+        trace_end("EndDrawing", trace_start);
+        write_perf_frame(frame++);
+        track_input_latency();
+        publish_frame_metrics(GetFrameTime());
+        if (first_frame) {
+            first_frame = false;
+            mark_startup_phase("first EndDrawing", NULL);
+            TraceLog(LOG_INFO, "STARTUP: First frame after %.2f ms", (get_wall_time() - start_time) * 1000.0);
+        }
+        if (startup_profile.enabled && assets_ready) {
+            print_startup_profile();
+            break;
+        }
     }
+    stop_simulation();
+    if (heatmap_file) {
+        state = sim_state;
+        save_heatmaps(heatmap_file);
+    }
+    stop_trace();
+    stop_metrics(METRICS_SHM_NAME);
+    stop_perf_counters();
+    stop_event_log();
+    stop_jobs();
+    free_trace();
+    free_render_prep();
+    print_input_latency();
+    state = sim_state;
+    unload_assets();
     CloseWindow();
+    unload_mazes();
+    free(state->grid);
     free(state);
     return 0;
 }
-
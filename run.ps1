@@ -1,6 +1,7 @@
 param (
     [switch]$debug,
-    [switch]$gdb
+    [switch]$gdb,
+    [switch]$png_assets # decode the png files at startup on the asset loader thread instead of embedding them
 )
 
 function log {
@@ -36,18 +37,72 @@ if ($debug -or $gdb) {
     )
 }
 
+if ($IsLinux) {
+    # the bundled raylib is windows only, link against the system one
+    $link_args = @(
+        "-lraylib",
+        "-lGL",
+        "-lm",
+        "-ldl",
+        "-lrt",
+        "-lX11"
+    )
+} else {
+    $link_args = @(
+        "-L./raylib/lib/",
+        "-lraylib",
+        "-lopengl32",
+        "-lgdi32",
+        "-lwinmm"
+    )
+}
+
+# decode the sprites once at build time and bake the pixels into the executable
+$embed_exe = "./build/embed.exe"
+$assets_h = "./build/assets.h"
+$assets = @(
+    "./frightened.png",
+    "./returning.png",
+    "./blinky.png",
+    "./pinky.png",
+    "./inky.png",
+    "./clyde.png"
+)
+
+if ($png_assets) {
+    # the executable then has to run from the directory containing the images
+    $args += @(
+        "-DEMBEDDED_ASSETS=0"
+    )
+} else {
+    log "Embedding assets"
+
+    & clang -O2 -std=c99 -o $embed_exe ./embed.c -I./raylib/include/ @link_args
+    if ($LASTEXITCODE -eq 0) {
+        & $embed_exe $assets_h @assets
+    }
+
+    if ($LASTEXITCODE -ne 0) {
+        log "You are a horrible person" "Red"
+        exit $LASTEXITCODE
+    }
+
+    $args += @(
+        "-DEMBEDDED_ASSETS"
+    )
+}
+
 $args += @(
     "-o", $output_exe,
     $input_c,
     "-std=c99",
+    "-pthread",
     "-I./raylib/include/",
-    "-L./raylib/lib/",
-    "-lraylib",
-    "-lopengl32",
-    "-lgdi32",
-    "-lwinmm"
+    "-I$build_dir"
 )
 
+$args += $link_args
+
 log "Building $input_c"
 
 & clang @args